@@ -1176,7 +1176,11 @@ void luaC_forcestep (lua_State *L) {
 */
 void luaC_step (lua_State *L) {
   global_State *g = G(L);
-  if (g->gcrunning) luaC_forcestep(L);
+  if (g->gcrunning) {
+    luai_gcstepbegin(L);
+    luaC_forcestep(L);
+    luai_gcstepend(L);
+  }
   else luaE_setdebt(g, -GCSTEPSIZE);  /* avoid being called too often */
 }
 
@@ -0,0 +1,61 @@
+/*
+** Jump table for threaded dispatch in luaV_execute (see LUA_USE_JUMPTABLE).
+** Included inside luaV_execute; every opcode needs an entry here and a
+** vmcase in lvm.c.
+*/
+
+static const void *const disptab[NUM_OPCODES] = {
+  [OP_MOVE] = &&L_OP_MOVE,
+  [OP_LOADK] = &&L_OP_LOADK,
+  [OP_LOADKX] = &&L_OP_LOADKX,
+  [OP_LOADBOOL] = &&L_OP_LOADBOOL,
+  [OP_LOADNIL] = &&L_OP_LOADNIL,
+  [OP_GETUPVAL] = &&L_OP_GETUPVAL,
+  [OP_GETTABUP] = &&L_OP_GETTABUP,
+  [OP_GETTABLE] = &&L_OP_GETTABLE,
+  [OP_SETTABUP] = &&L_OP_SETTABUP,
+  [OP_SETUPVAL] = &&L_OP_SETUPVAL,
+  [OP_SETTABLE] = &&L_OP_SETTABLE,
+  [OP_NEWTABLE] = &&L_OP_NEWTABLE,
+  [OP_SELF] = &&L_OP_SELF,
+  [OP_ADD] = &&L_OP_ADD,
+  [OP_SUB] = &&L_OP_SUB,
+  [OP_MUL] = &&L_OP_MUL,
+  [OP_DIV] = &&L_OP_DIV,
+  [OP_MOD] = &&L_OP_MOD,
+  [OP_POW] = &&L_OP_POW,
+  [OP_IDIV] = &&L_OP_IDIV,
+  [OP_BAND] = &&L_OP_BAND,
+  [OP_BOR] = &&L_OP_BOR,
+  [OP_BXOR] = &&L_OP_BXOR,
+  [OP_SHL] = &&L_OP_SHL,
+  [OP_SHR] = &&L_OP_SHR,
+  [OP_LSHR] = &&L_OP_LSHR,
+  [OP_ROTL] = &&L_OP_ROTL,
+  [OP_ROTR] = &&L_OP_ROTR,
+  [OP_UNM] = &&L_OP_UNM,
+  [OP_BNOT] = &&L_OP_BNOT,
+  [OP_NOT] = &&L_OP_NOT,
+  [OP_PEEK] = &&L_OP_PEEK,
+  [OP_PEEK2] = &&L_OP_PEEK2,
+  [OP_PEEK4] = &&L_OP_PEEK4,
+  [OP_LEN] = &&L_OP_LEN,
+  [OP_CONCAT] = &&L_OP_CONCAT,
+  [OP_JMP] = &&L_OP_JMP,
+  [OP_EQ] = &&L_OP_EQ,
+  [OP_LT] = &&L_OP_LT,
+  [OP_LE] = &&L_OP_LE,
+  [OP_TEST] = &&L_OP_TEST,
+  [OP_TESTSET] = &&L_OP_TESTSET,
+  [OP_CALL] = &&L_OP_CALL,
+  [OP_TAILCALL] = &&L_OP_TAILCALL,
+  [OP_RETURN] = &&L_OP_RETURN,
+  [OP_FORLOOP] = &&L_OP_FORLOOP,
+  [OP_FORPREP] = &&L_OP_FORPREP,
+  [OP_TFORCALL] = &&L_OP_TFORCALL,
+  [OP_TFORLOOP] = &&L_OP_TFORLOOP,
+  [OP_SETLIST] = &&L_OP_SETLIST,
+  [OP_CLOSURE] = &&L_OP_CLOSURE,
+  [OP_VARARG] = &&L_OP_VARARG,
+  [OP_EXTRAARG] = &&L_OP_EXTRAARG,
+};
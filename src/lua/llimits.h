@@ -190,6 +190,18 @@ typedef lu_int32 Instruction;
 #define luai_userstateyield(L,n)        ((void)L)
 #endif
 
+/*
+** these macros allow user-specific actions around each incremental
+** garbage-collector step
+*/
+#if !defined(luai_gcstepbegin)
+#define luai_gcstepbegin(L)		((void)L)
+#endif
+
+#if !defined(luai_gcstepend)
+#define luai_gcstepend(L)		((void)L)
+#endif
+
 /*
 ** lua_number2int is a macro to convert lua_Number (fix32_t) to int.
 ** lua_number2integer is a macro to convert lua_Number to lua_Integer.
@@ -473,6 +473,7 @@ typedef struct Proto {
   LocVar *locvars;  /* information about local variables (debug information) */
   Upvaldesc *upvalues;  /* upvalue information */
   union Closure *cache;  /* last created closure with this prototype */
+  struct KCache *kcache;  /* global lookup caches, one per constant */
   TString  *source;  /* used for debug information */
   int sizeupvalues;  /* size of 'upvalues' */
   int sizek;  /* size of `k' */
@@ -567,9 +568,22 @@ typedef struct Table {
   Node *lastfree;  /* any free position is before this position */
   struct Table *metatable;
   GCObject *gclist;
+  unsigned int nodeversion;  /* changes whenever `node' is reallocated */
 } Table;
 
 
+/*
+** Inline cache for a global (an upvalue table indexed by a constant
+** string): the node that held the key the last time it was looked up.
+** Valid while the table and its node version still match.
+*/
+typedef struct KCache {
+  Table *t;
+  Node *n;
+  unsigned int nodeversion;
+} KCache;
+
+
 
 /*
 ** `module' operation for hashing (size is always a power of 2)
@@ -86,10 +86,24 @@ typedef struct LG {
   { size_t t = cast(size_t, e); \
     memcpy(buff + p, &t, sizeof(t)); p += sizeof(t); }
 
+static unsigned int fixedseed = 0;
+
+/*
+** use a fixed seed for the string hashes of states created from now on
+** (0 = random), so that a collection frees memory in the same order on
+** every run
+*/
+LUA_API void lua_setfixedseed (unsigned int seed) {
+  fixedseed = seed;
+}
+
+
 static unsigned int makeseed (lua_State *L) {
   char buff[4 * sizeof(size_t)];
   unsigned int h = luai_makeseed();
   int p = 0;
+  if (fixedseed != 0)
+    return fixedseed;
   addbuff(buff, p, L);  /* heap variable */
   addbuff(buff, p, &h);  /* local variable */
   addbuff(buff, p, luaO_nilobject);  /* global variable */
@@ -281,6 +295,7 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   g->ud = ud;
   g->mainthread = L;
   g->seed = makeseed(L);
+  g->nodeversion = 0;
   g->uvhead.u.l.prev = &g->uvhead;
   g->uvhead.u.l.next = &g->uvhead;
   g->gcrunning = 0;  /* no GC while building state */
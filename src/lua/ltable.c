@@ -298,6 +298,7 @@ static void setnodevector (lua_State *L, Table *t, int size) {
   }
   t->lsizenode = cast_byte(lsize);
   t->lastfree = gnode(t, size);  /* all positions are free */
+  t->nodeversion = ++G(L)->nodeversion;  /* invalidate cached nodes */
 }
 
 
@@ -475,6 +476,22 @@ const TValue *luaH_getstr (Table *t, TString *key) {
 }
 
 
+/*
+** search function for short strings that returns the node holding the
+** key, or NULL if the key is not in the hash part
+*/
+Node *luaH_getstrnode (Table *t, TString *key) {
+  Node *n = hashstr(t, key);
+  lua_assert(key->tsv.tt == LUA_TSHRSTR);
+  do {
+    if (ttisshrstring(gkey(n)) && eqshrstr(rawtsvalue(gkey(n)), key))
+      return n;
+    else n = gnext(n);
+  } while (n);
+  return NULL;
+}
+
+
 /*
 ** main search function
 */
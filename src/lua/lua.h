@@ -258,6 +258,7 @@ LUA_API int   (lua_setmetatable) (lua_State *L, int objindex);
 LUA_API void  (lua_setuservalue) (lua_State *L, int idx);
 
 LUA_API void  (lua_setpico8memory) (lua_State *L, unsigned char const *p);
+LUA_API void  (lua_setfixedseed) (unsigned int seed);
 
 /*
 ** 'load' and 'call' functions (load and run Lua code)
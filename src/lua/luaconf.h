@@ -592,6 +592,19 @@
 
 #define LUA_USE_LONGJMP
 
+/*
+@@ LUA_USE_JUMPTABLE makes luaV_execute jump from each opcode straight to
+** the next through a table of label addresses (a GCC/Clang extension)
+** instead of going back round a switch. Define it as 0 to use the switch.
+*/
+#if !defined(LUA_USE_JUMPTABLE)
+#if defined(__GNUC__)
+#define LUA_USE_JUMPTABLE	1
+#else
+#define LUA_USE_JUMPTABLE	0
+#endif
+#endif
+
 #define LUA_COMPAT_UNPACK
 
 /*
@@ -667,5 +680,14 @@ static inline int lua_number2str_fn(char *s, fix32_t n) {
 */
 #define l_mathop(x)		(x)
 
+/*
+** Time each incremental collector step for the frame profiler
+** (p8_profile.c).
+*/
+extern void profile_gc_step_begin(void);
+extern void profile_gc_step_end(void);
+#define luai_gcstepbegin(L)	profile_gc_step_begin()
+#define luai_gcstepend(L)	profile_gc_step_end()
+
 #endif
 
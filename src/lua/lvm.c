@@ -19,6 +19,7 @@
 #include "ldo.h"
 #include "lfunc.h"
 #include "lgc.h"
+#include "lmem.h"
 #include "lobject.h"
 #include "lopcodes.h"
 #include "lstate.h"
@@ -524,6 +525,46 @@ void luaV_finishOp (lua_State *L) {
 
 
 
+/*
+** Inline caches for globals: OP_GETTABUP/OP_SETTABUP with a constant
+** string key remember, per constant of the function, the node that held
+** the key. A hit needs the same table with the same node vector and the
+** key still in that node; anything else takes the normal path.
+*/
+static TValue *kcache_get (Proto *p, int idx, const TValue *t) {
+  KCache *kc;
+  Node *n;
+  if (p->kcache == NULL || !ttistable(t)) return NULL;
+  kc = &p->kcache[idx];
+  if (kc->t != hvalue(t) || kc->nodeversion != kc->t->nodeversion)
+    return NULL;
+  n = kc->n;
+  if (!ttisshrstring(gkey(n)) || rawtsvalue(gkey(n)) != rawtsvalue(p->k + idx))
+    return NULL;
+  /* an absent value may need `__index' or `__newindex' */
+  return ttisnil(gval(n)) ? NULL : gval(n);
+}
+
+
+static void kcache_update (lua_State *L, Proto *p, int idx, const TValue *t) {
+  Node *n;
+  KCache *kc;
+  if (!ttistable(t) || !ttisshrstring(p->k + idx)) return;
+  if (p->kcache == NULL) {
+    int j;
+    kc = luaM_newvector(L, p->sizek, KCache);
+    for (j = 0; j < p->sizek; j++) kc[j].t = NULL;
+    p->kcache = kc;
+  }
+  n = luaH_getstrnode(hvalue(t), rawtsvalue(p->k + idx));
+  if (n == NULL) return;
+  kc = &p->kcache[idx];
+  kc->t = hvalue(t);
+  kc->n = n;
+  kc->nodeversion = kc->t->nodeversion;
+}
+
+
 /*
 ** some macros for common tasks in `luaV_execute'
 */
@@ -581,15 +622,37 @@ void luaV_finishOp (lua_State *L) {
         } \
         else { Protect(luaV_arith(L, ra, rb, rb, tm)); } }
 
+/* fetch the next instruction, run any hook and decode its A operand */
+#define vmfetch() { \
+    i = *(ci->u.l.savedpc++); \
+    if ((L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT)) && \
+        (--L->hookcount == 0 || L->hookmask & LUA_MASKLINE)) { \
+      Protect(traceexec(L)); \
+    } \
+    /* WARNING: several calls may realloc the stack and invalidate `ra' */ \
+    ra = RA(i); \
+    lua_assert(base == ci->u.l.base); \
+    lua_assert(base <= L->top && L->top < L->stack + L->stacksize); }
+
+#if LUA_USE_JUMPTABLE
+/* each opcode fetches the next one and jumps straight to it */
+#define vmdispatch(o)	goto *disptab[o];
+#define vmcase(l,b)	L_##l: {b} vmfetch(); vmdispatch(GET_OPCODE(i))
+#define vmcasenb(l,b)	L_##l: {b}		/* nb = no break */
+#else
 #define vmdispatch(o)	switch(o)
 #define vmcase(l,b)	case l: {b}  break;
 #define vmcasenb(l,b)	case l: {b}		/* nb = no break */
+#endif
 
 void luaV_execute (lua_State *L) {
   CallInfo *ci = L->ci;
   LClosure *cl;
   TValue *k;
   StkId base;
+#if LUA_USE_JUMPTABLE
+#include "ljumptab.h"
+#endif
  newframe:  /* reentry point when frame changes (call/return) */
   lua_assert(ci == L->ci);
   cl = clLvalue(ci->func);
@@ -597,16 +660,9 @@ void luaV_execute (lua_State *L) {
   base = ci->u.l.base;
   /* main loop of interpreter */
   for (;;) {
-    Instruction i = *(ci->u.l.savedpc++);
+    Instruction i;
     StkId ra;
-    if ((L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT)) &&
-        (--L->hookcount == 0 || L->hookmask & LUA_MASKLINE)) {
-      Protect(traceexec(L));
-    }
-    /* WARNING: several calls may realloc the stack and invalidate `ra' */
-    ra = RA(i);
-    lua_assert(base == ci->u.l.base);
-    lua_assert(base <= L->top && L->top < L->stack + L->stacksize);
+    vmfetch();
     vmdispatch (GET_OPCODE(i)) {
       vmcase(OP_MOVE,
         setobjs2s(L, ra, RB(i));
@@ -637,14 +693,38 @@ void luaV_execute (lua_State *L) {
       )
       vmcase(OP_GETTABUP,
         int b = GETARG_B(i);
-        Protect(luaV_gettable(L, cl->upvals[b]->v, RKC(i), ra));
+        int c = GETARG_C(i);
+        TValue *v = ISK(c) ? kcache_get(cl->p, INDEXK(c), cl->upvals[b]->v)
+                           : NULL;
+        if (v != NULL) {
+          setobj2s(L, ra, v);
+        }
+        else {
+          Protect(luaV_gettable(L, cl->upvals[b]->v, RKC(i), ra));
+          if (ISK(c))
+            Protect(kcache_update(L, cl->p, INDEXK(c), cl->upvals[b]->v));
+        }
       )
       vmcase(OP_GETTABLE,
         Protect(luaV_gettable(L, RB(i), RKC(i), ra));
       )
       vmcase(OP_SETTABUP,
         int a = GETARG_A(i);
-        Protect(luaV_settable(L, cl->upvals[a]->v, RKB(i), RKC(i)));
+        int b = GETARG_B(i);
+        TValue *v = ISK(b) ? kcache_get(cl->p, INDEXK(b), cl->upvals[a]->v)
+                           : NULL;
+        if (v != NULL) {  /* same as `luaV_settable' on an existing key */
+          Table *h = hvalue(cl->upvals[a]->v);
+          TValue *rc = RKC(i);
+          setobj2t(L, v, rc);
+          invalidateTMcache(h);
+          luaC_barrierback(L, obj2gco(h), rc);
+        }
+        else {
+          Protect(luaV_settable(L, cl->upvals[a]->v, RKB(i), RKC(i)));
+          if (ISK(b))
+            Protect(kcache_update(L, cl->p, INDEXK(b), cl->upvals[a]->v));
+        }
       )
       vmcase(OP_SETUPVAL,
         UpVal *uv = cl->upvals[GETARG_B(i)];
@@ -8,10 +8,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "p8_alloc.h"
+#include "p8_audio.h"
 #include "p8_main.h"
 #include "p8_parser.h"
 #include "p8_emu.h"
 #include "p8_lua.h"
+#include "p8_profile.h"
+#include "p8_replay.h"
 #include "strtcpy.h"
 #ifdef NEXTP8
 #include "nextp8.h"
@@ -45,6 +49,7 @@ int main(int argc, char *argv[])
     const char *file_name = NULL;
     const char *param_string = NULL;
     bool skip_main_loop = false;
+    bool headless = false;
     int exit_code = EXIT_SUCCESS;
 
     for (int i = 1; i < argc; i++) {
@@ -53,6 +58,35 @@ int main(int argc, char *argv[])
             return 0;
         } else if (strcmp(argv[i], "--skip-compat-check") == 0) {
             // Ignore for compatibiliy
+        } else if (strcmp(argv[i], "--headless") == 0) {
+            headless = true;
+        } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            replay_set_frame_limit(strtoul(argv[++i], NULL, 0));
+        } else if (strcmp(argv[i], "--hash-every") == 0 && i + 1 < argc) {
+            replay_set_hash_interval(strtoul(argv[++i], NULL, 0));
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            // Same as srand(n): the integer part of a fix32 seed.
+            replay_set_seed((uint32_t)strtoul(argv[++i], NULL, 0) << 16);
+        } else if (strcmp(argv[i], "--input") == 0 && i + 1 < argc) {
+            if (replay_load_input(argv[++i]) != 0)
+                return EXIT_FAILURE;
+#ifdef ENABLE_AUDIO
+        } else if (strcmp(argv[i], "--wav") == 0 && i + 1 < argc) {
+            if (audio_open_wav(argv[++i]) != 0)
+                return EXIT_FAILURE;
+        } else if (strcmp(argv[i], "--audio-latency") == 0 && i + 1 < argc) {
+            audio_set_latency(strtoul(argv[++i], NULL, 0));
+#endif
+        } else if (strcmp(argv[i], "--mem-limit") == 0 && i + 1 < argc) {
+            // Lua memory limit in KB; 0 for none, 2048 matches PICO-8.
+            alloc_set_limit((size_t)strtoul(argv[++i], NULL, 0) * 1024);
+        } else if (strcmp(argv[i], "--gc-idle-only") == 0) {
+            lua_set_gc_idle_only(true);
+        } else if (strcmp(argv[i], "--profile") == 0) {
+            profile_show_overlay(true);
+        } else if (strcmp(argv[i], "--profile-csv") == 0 && i + 1 < argc) {
+            if (profile_open_csv(argv[++i]) != 0)
+                return EXIT_FAILURE;
         } else if (strcmp(argv[i], "-x") == 0) {
             skip_main_loop = true;
         } else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
@@ -123,6 +157,13 @@ int main(int argc, char *argv[])
     }
 #endif
 #endif
+    if ((headless || replay_is_active()) && file_name == NULL) {
+        fprintf(stderr, "%s requires a cart file\n", headless ? "--headless" : "Replay mode");
+        return EXIT_FAILURE;
+    }
+    if (headless)
+        p8_set_headless(true);
+
     p8_init();
 
     if (file_name == NULL) {
@@ -0,0 +1,217 @@
+/**
+ * Copyright (C) 2026 Chris January
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "p8_alloc.h"
+#include "p8_emu.h"
+
+/* Limit applied at startup; 0 for none. */
+#ifndef ALLOC_DEFAULT_LIMIT
+#if defined(OS_BAREMETAL) || defined(OS_FREERTOS)
+#define ALLOC_DEFAULT_LIMIT ALLOC_PICO8_LIMIT
+#else
+#define ALLOC_DEFAULT_LIMIT 0
+#endif
+#endif
+
+#define ALLOC_ALIGN 8
+#define SMALL_MAX 256
+#define CLASS_COUNT (SMALL_MAX / ALLOC_ALIGN)
+#define ARENA_SIZE 16384
+
+typedef struct free_block {
+    struct free_block *next;
+} free_block_t;
+
+/* Arenas are chained through their first ALLOC_ALIGN bytes. */
+typedef struct arena {
+    struct arena *next;
+} arena_t;
+
+static free_block_t *free_lists[CLASS_COUNT];
+static arena_t *arenas = NULL;
+static uint8_t *arena_next = NULL;
+static uint8_t *arena_end = NULL;
+static size_t usage = 0;
+static size_t limit = ALLOC_DEFAULT_LIMIT;
+
+/* Size class for 1 to SMALL_MAX bytes; class c holds (c + 1) * ALLOC_ALIGN. */
+static inline int size_class(size_t size)
+{
+    return (int)((size - 1) / ALLOC_ALIGN);
+}
+
+static inline void small_free(void *ptr, int c)
+{
+    free_block_t *block = (free_block_t *)ptr;
+    block->next = free_lists[c];
+    free_lists[c] = block;
+}
+
+static bool new_arena(void)
+{
+    arena_t *arena = (arena_t *)malloc(ARENA_SIZE);
+    if (!arena)
+        return false;
+
+    // Whatever is left of the current arena is smaller than the request
+    // that did not fit, so it always makes a valid block of some class.
+    // It moves to a free list only once the bump pointer leaves it.
+    size_t rest = (size_t)(arena_end - arena_next);
+    if (rest >= ALLOC_ALIGN)
+        small_free(arena_next, (int)(rest / ALLOC_ALIGN) - 1);
+
+    arena->next = arenas;
+    arenas = arena;
+    arena_next = (uint8_t *)arena + ALLOC_ALIGN;
+    arena_end = (uint8_t *)arena + ARENA_SIZE;
+    return true;
+}
+
+static void *small_alloc(int c)
+{
+    free_block_t *block = free_lists[c];
+    if (block) {
+        free_lists[c] = block->next;
+        return block;
+    }
+    size_t size = (size_t)(c + 1) * ALLOC_ALIGN;
+    if ((size_t)(arena_end - arena_next) < size && !new_arena())
+        return NULL;
+    void *ptr = arena_next;
+    arena_next += size;
+    return ptr;
+}
+
+/* Large blocks are never smaller than an arena holding one small block, so
+ * that one can always be reused as an arena when shrinking it fails. */
+static inline size_t large_size(size_t size)
+{
+    return MAX(size, ALLOC_ALIGN + SMALL_MAX);
+}
+
+static void *large_alloc(size_t size)
+{
+    return malloc(large_size(size));
+}
+
+static void *large_realloc(void *ptr, size_t osize, size_t nsize)
+{
+    nsize = large_size(nsize);
+#ifdef OS_FREERTOS
+    // malloc and free are redirected to rh_malloc/rh_free, realloc is not.
+    void *block = malloc(nsize);
+    if (block) {
+        memcpy(block, ptr, MIN(osize, nsize));
+        free(ptr);
+    }
+    return block;
+#else
+    (void)osize;
+    return realloc(ptr, nsize);
+#endif
+}
+
+/* Turn a large block into an arena holding its first size bytes as a small
+ * block, for when there is no memory to move it into one. The rest of the
+ * block is unused until alloc_reset frees the arena. */
+static void *large_to_arena(void *ptr, size_t size)
+{
+    uint8_t *block = (uint8_t *)ptr + ALLOC_ALIGN;
+    memmove(block, ptr, size);
+    arena_t *arena = (arena_t *)ptr;
+    arena->next = arenas;
+    arenas = arena;
+    return block;
+}
+
+static void release(void *ptr, size_t size)
+{
+    if (size <= SMALL_MAX)
+        small_free(ptr, size_class(size));
+    else
+        free(ptr);
+}
+
+void *alloc_lua(void *ud, void *ptr, size_t osize, size_t nsize)
+{
+    (void)ud;
+    if (ptr == NULL)
+        osize = 0;  // Lua passes the object type instead
+
+    if (nsize == 0) {
+        if (ptr) {
+            release(ptr, osize);
+            usage -= osize;
+        }
+        return NULL;
+    }
+
+    // Lua runs an emergency collection and retries before raising
+    // "not enough memory".
+    if (limit != 0 && nsize > osize && usage - osize + nsize > limit)
+        return NULL;
+
+    void *block;
+    if (ptr && osize <= SMALL_MAX && nsize <= SMALL_MAX &&
+        size_class(osize) == size_class(nsize)) {
+        block = ptr;
+    } else if (ptr && osize > SMALL_MAX && nsize > SMALL_MAX) {
+        block = large_realloc(ptr, osize, nsize);
+    } else {
+        block = nsize <= SMALL_MAX ? small_alloc(size_class(nsize)) : large_alloc(nsize);
+        if (block && ptr) {
+            memcpy(block, ptr, MIN(osize, nsize));
+            release(ptr, osize);
+        }
+    }
+
+    if (!block) {
+        // Lua does not allow shrinking to fail. Keep the bigger block; it
+        // is freed as the smaller size later, which wastes the difference.
+        // A large block must not end up on a small free list, so it
+        // becomes an arena instead.
+        if (!ptr || nsize > osize)
+            return NULL;
+        if (osize > SMALL_MAX && nsize <= SMALL_MAX)
+            block = large_to_arena(ptr, nsize);
+        else
+            block = ptr;
+    }
+
+    usage = usage - osize + nsize;
+    return block;
+}
+
+size_t alloc_usage(void)
+{
+    return usage;
+}
+
+void alloc_set_limit(size_t new_limit)
+{
+    limit = new_limit == 0 ? 0 : MAX(new_limit, ALLOC_MIN_LIMIT);
+}
+
+size_t alloc_get_limit(void)
+{
+    return limit;
+}
+
+void alloc_reset(void)
+{
+    while (arenas) {
+        arena_t *next = arenas->next;
+        free(arenas);
+        arenas = next;
+    }
+    memset(free_lists, 0, sizeof(free_lists));
+    arena_next = NULL;
+    arena_end = NULL;
+    usage = 0;
+}
@@ -0,0 +1,45 @@
+/**
+ * Copyright (C) 2026 Chris January
+ *
+ * Allocator for the Lua state. Small blocks come from free lists, one per
+ * size class, carved out of larger arenas; bigger blocks go to malloc.
+ * Keeps an exact count of the bytes Lua has allocated and can refuse to
+ * go over a limit, like PICO-8's 2 MB, so the cart gets an out of memory
+ * error instead of exhausting the host.
+ */
+
+#ifndef P8_ALLOC_H
+#define P8_ALLOC_H
+
+#include <stddef.h>
+
+/* PICO-8's limit on Lua memory. */
+#define ALLOC_PICO8_LIMIT (2 * 1024 * 1024)
+
+/* Smallest limit accepted: the API and a small cart fit comfortably. */
+#define ALLOC_MIN_LIMIT (256 * 1024)
+
+/**
+ * lua_Alloc function to pass to lua_newstate(). The user data is unused.
+ */
+void *alloc_lua(void *ud, void *ptr, size_t osize, size_t nsize);
+
+/**
+ * Bytes currently allocated by Lua.
+ */
+size_t alloc_usage(void);
+
+/**
+ * Set the most bytes Lua may have allocated at once, or 0 for no limit.
+ * Limits below ALLOC_MIN_LIMIT are raised to it.
+ */
+void alloc_set_limit(size_t limit);
+
+size_t alloc_get_limit(void);
+
+/**
+ * Release the arenas. Only call once the Lua state has been closed.
+ */
+void alloc_reset(void);
+
+#endif /* P8_ALLOC_H */
@@ -5,20 +5,20 @@
  *      Author: bbaker
  */
 
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <string.h>
 #include <math.h>
 #include "p8_audio.h"
 #include "p8_dsp.h"
 #include "p8_emu.h"
-#include "queue.h"
+#include "p8_profile.h"
+#include "p8_ring.h"
 
 #ifdef ENABLE_AUDIO
-#ifndef OS_BAREMETAL
-#include <pthread.h>
-#endif
 
 #ifdef SDL
 #include "SDL.h"
@@ -28,6 +28,7 @@
 #include "nextp8.h"
 #endif
 
+#define CUSTOM_MASK 0x8000
 #define EFFECT_MASK 0x7000
 #define VOLUME_MASK 0x0E00
 #define WAVEFORM_MASK 0x01C0
@@ -37,6 +38,12 @@
 #define VOLUME_SHIFT 9
 #define WAVEFORM_SHIFT 6
 
+#define SFX_NOTE_COUNT 32
+#define MIX_RING_SIZE 16384     // samples; more than the longest latency
+#define MIX_BLOCK_SIZE 256      // samples the mixer thread renders at a time
+#define MIX_WAIT_MS 10
+#define MUSIC_ENTRY_SIZE 4
+
 #ifdef NEXTP8
 #define PCM_BUFFER_SIZE (_DA_MEMORY_SIZE / 2)
 #else
@@ -63,8 +70,44 @@ typedef struct
     int sample;
     int position;
     int end;
+    dsp_osc_t osc;
 } soundstate_t;
 
+typedef struct
+{
+    uint8_t pitch;
+    uint8_t slide_from;     // pitch a slide starts at: the previous note's
+    uint8_t waveform;
+    uint8_t volume;
+    uint8_t effect;
+    uint8_t custom;         // waveform is the index of an instrument SFX
+} sfxnote_t;
+
+typedef struct
+{
+    sfxnote_t notes[SFX_NOTE_COUNT];
+    int sample_per_tick;
+    uint8_t filters;        // the editor mode byte, which holds the filter flags
+    uint8_t speed;
+    uint8_t loop_start;
+    uint8_t loop_end;
+} sfx_t;
+
+typedef struct
+{
+    int8_t sound_index[CHANNEL_COUNT];  // -1 where the channel is disabled
+    bool loop_begin;
+    bool loop_end;
+    bool stop;
+} pattern_t;
+
+/* Sound RAM decoded into the form the renderer uses. */
+typedef struct
+{
+    sfx_t sfx[SOUND_COUNT];
+    pattern_t patterns[MUSIC_COUNT];
+} soundbank_t;
+
 typedef struct
 {
     int32_t index;
@@ -91,6 +134,14 @@ typedef struct
     };
 } soundcommand_t;
 
+/* What stat() reports about the channels. */
+typedef struct
+{
+    soundstate_t channels[CHANNEL_COUNT];
+    musicstate_t music;
+    unsigned commands;      // sound commands applied so far
+} soundstatus_t;
+
 enum
 {
     TONE_C,
@@ -107,18 +158,6 @@ enum
     TONE_B
 };
 
-enum
-{
-    WAVEFORM_TRIANGLE,
-    WAVEFORM_TILTEDSAW,
-    WAVEFORM_SAW,
-    WAVEFORM_SQUARE,
-    WAVEFORM_PULSE,
-    WAVEFORM_ORGAN,
-    WAVEFORM_NOISE,
-    WAVEFORM_PHASER
-};
-
 enum
 {
     EFFECT_NONE,
@@ -137,6 +176,7 @@ const char *m_tone_map[] = {
 const float m_tone_frequencies[] = {
     130.81f, 138.59f, 146.83f, 155.56f, 164.81f, 174.61f, 185.00f, 196.00f, 207.65f, 220.0f, 233.08f, 246.94f};
 
+float get_frequency(int pitch);
 void render_sounds(int16_t *buffer, int total_samples);
 
 #ifdef NEXTP8
@@ -145,35 +185,186 @@ int m_pcm_write_pos = 0;
 bool m_music_enabled = true;
 bool m_sound_enabled = true;
 
+// Both rings are written by the Lua thread and read by the audio callback.
 soundcommand_t m_sound_buffer[SOUND_QUEUE_SIZE];
+ring_t m_sound_queue = RING_INIT(m_sound_buffer, SOUND_QUEUE_SIZE);
 
-queue_t m_sound_queue = {
-    .data_buf = m_sound_buffer,
-    .elements_num_max = SOUND_QUEUE_SIZE,
-    .elements_size = sizeof(soundcommand_t),
-};
-
-#ifndef OS_BAREMETAL
-pthread_mutex_t m_sound_queue_mutex;
-#endif
-
+// Only the audio thread, which applies the sound commands, touches these.
 soundstate_t m_channels[CHANNEL_COUNT];
 musicstate_t m_music_state;
+unsigned m_commands_applied = 0;
+
+// The audio thread publishes the channel state for stat() after each block,
+// through a triple buffer like the sound banks. The Lua thread applies the
+// commands it sends to its own copy, and takes the published state again once
+// the audio thread has caught up with all of them.
+#define STATUS_FRESH 4
+
+soundstatus_t m_sound_status[3];
+int m_status_write = 0;
+atomic_int m_status_shared = 1;
+int m_status_read = 2;
+soundstatus_t m_status_shadow;
+unsigned m_commands_sent = 0;
+
+// Oscillator phase increment for each pitch.
+uint32_t m_pitch_steps[64];
+
+// Triple buffer of decoded sound RAM. The Lua thread decodes into
+// m_bank_write and swaps it with m_bank_shared, flagged BANK_FRESH; the
+// audio thread swaps a fresh m_bank_shared with m_bank_read and renders from
+// that. Neither thread ever waits for the other, and the audio thread never
+// sees a bank that is being written.
+#define BANK_FRESH 4
+
+soundbank_t m_sound_banks[3];
+int m_bank_write = 0;
+int m_bank_latest = 2;          // the bank the Lua thread published last
+atomic_int m_bank_shared = 1;
+int m_bank_read = 2;
+
+// Whether the mixer runs, on the audio device or for the WAV file. With no
+// mixer nothing empties the sound queue or the PCM ring, so they are not
+// written.
+bool m_audio_consumer = false;
 
 uint8_t m_pcm_buffer[PCM_BUFFER_SIZE];
-int m_pcm_write_pos = 0;
-int m_pcm_read_pos = 0;
-int m_pcm_buffered = 0;
+ring_t m_pcm_ring = RING_INIT(m_pcm_buffer, PCM_BUFFER_SIZE);
+uint8_t m_pcm_sample = 128;
 int m_pcm_repeat = 0;
 int16_t m_pcm_dampen = 0;
 
+// Offline rendering: the audio goes to a WAV file a frame at a time
+// instead of to the audio device.
+FILE *m_wav_file = NULL;
+uint32_t m_wav_samples = 0;
+unsigned m_wav_frame_remainder = 0;
+p8_clock_t m_wav_render_time = 0;
+
+// The mixer thread renders up to m_mix_target samples ahead into m_mix_ring
+// and the device callback only copies them out, so a slow block is absorbed
+// by the lookahead instead of being heard.
+int16_t m_mix_buffer[MIX_RING_SIZE];
+ring_t m_mix_ring = RING_INIT(m_mix_buffer, MIX_RING_SIZE);
+unsigned m_latency_ms = AUDIO_DEFAULT_LATENCY_MS;
+unsigned m_mix_target = 0;      // 0 when audio is mixed in the callback
+atomic_uint m_underruns = 0;
+
+// Positions in the mixed output, in samples, to tell how much of the PCM
+// stream the mixer has taken ahead of what has been played.
+unsigned m_mix_position = 0;
+atomic_uint m_play_position = 0;
+atomic_uint m_pcm_end_position = 0;
+
 #ifdef SDL
 SDL_AudioSpec m_audio_spec;
+SDL_Thread *m_mix_thread = NULL;
+SDL_sem *m_mix_wake = NULL;
+atomic_bool m_mix_quit = false;
 #endif
 
+static void mix(int16_t *buffer, int samples)
+{
+    p8_clock_t profile_start = profile_begin();
+    render_sounds(buffer, samples);
+    profile_audio_end(profile_start);
+}
+
+static int mix_thread(void *data)
+{
+    (void)data;
+    int16_t block[MIX_BLOCK_SIZE];
+    while (!atomic_load(&m_mix_quit))
+    {
+        if (ring_count(&m_mix_ring) + MIX_BLOCK_SIZE <= m_mix_target)
+        {
+            mix(block, MIX_BLOCK_SIZE);
+            ring_write(&m_mix_ring, block, MIX_BLOCK_SIZE);
+        }
+        else
+        {
+            // Woken when the callback takes samples; the timeout covers a
+            // paused device.
+            SDL_SemWaitTimeout(m_mix_wake, MIX_WAIT_MS);
+        }
+    }
+    return 0;
+}
+
 void audio_callback(void *userdata, uint8_t *cbuffer, int length)
 {
-    render_sounds((int16_t *)cbuffer, length / sizeof(int16_t));
+    int16_t *buffer = (int16_t *)cbuffer;
+    unsigned samples = length / sizeof(int16_t);
+
+    if (!m_mix_thread)
+    {
+        mix(buffer, samples);
+        atomic_fetch_add_explicit(&m_play_position, samples, memory_order_release);
+        return;
+    }
+
+    unsigned copied = ring_read(&m_mix_ring, buffer, samples);
+    if (copied < samples)
+    {
+        memset(buffer + copied, 0, (samples - copied) * sizeof(int16_t));
+        atomic_fetch_add_explicit(&m_underruns, 1, memory_order_relaxed);
+    }
+    atomic_fetch_add_explicit(&m_play_position, copied, memory_order_release);
+    SDL_SemPost(m_mix_wake);
+}
+
+// Largest power of two up to a quarter of the latency: the device buffer
+// adds to the latency, and the rest of it is lookahead.
+static uint16_t device_buffer_size(unsigned latency)
+{
+    uint16_t samples = 128;
+    while (samples * 2 <= latency / 4 && samples * 2 <= SOUND_BUFFER_SIZE)
+        samples *= 2;
+    return samples;
+}
+
+static void put_le16(uint8_t *p, uint16_t value)
+{
+    p[0] = value & 0xff;
+    p[1] = value >> 8;
+}
+
+static void put_le32(uint8_t *p, uint32_t value)
+{
+    put_le16(p, value & 0xffff);
+    put_le16(p + 2, value >> 16);
+}
+
+static int write_wav_header(FILE *fp, uint32_t samples)
+{
+    const uint32_t data_size = samples * sizeof(int16_t);
+    uint8_t header[44];
+    memcpy(header, "RIFF", 4);
+    put_le32(header + 4, 36 + data_size);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    put_le32(header + 16, 16);                          // format chunk size
+    put_le16(header + 20, 1);                           // PCM
+    put_le16(header + 22, 1);                           // mono
+    put_le32(header + 24, SAMPLE_RATE);
+    put_le32(header + 28, SAMPLE_RATE * sizeof(int16_t));
+    put_le16(header + 32, sizeof(int16_t));             // bytes per frame
+    put_le16(header + 34, 16);                          // bits per sample
+    memcpy(header + 36, "data", 4);
+    put_le32(header + 40, data_size);
+    return fwrite(header, sizeof(header), 1, fp) == 1 ? 0 : 1;
+}
+
+static void close_wav(void)
+{
+    if (fseek(m_wav_file, 0, SEEK_SET) != 0 || write_wav_header(m_wav_file, m_wav_samples) != 0)
+        fputs("Failed to write WAV header\n", stderr);
+    fclose(m_wav_file);
+    m_wav_file = NULL;
+
+    unsigned render_us = p8_clock_us(m_wav_render_time);
+    fprintf(stderr, "Rendered %u samples of audio in %u ms (%.0f samples/s)\n",
+            (unsigned)m_wav_samples, render_us / 1000,
+            render_us ? m_wav_samples * 1e6 / render_us : 0.0);
 }
 #endif
 
@@ -190,22 +381,48 @@ void audio_init()
     *(volatile uint16_t *)_DA_PERIOD = _DA_CLKS_PER_SECOND * 2 / 11025;
     *(volatile uint16_t *)_DA_CONTROL = (1 << 0) | (1 << 8);
 #else
-    _queue_init(&m_sound_queue);
+    dsp_init();
+    for (int i = 0; i < CHANNEL_COUNT; i++)
+        dsp_osc_init(&m_channels[i].osc);
+    for (int pitch = 0; pitch < 64; pitch++)
+        m_pitch_steps[pitch] = dsp_phase_step(get_frequency(pitch), SAMPLE_RATE);
 
     m_audio_spec.freq = SAMPLE_RATE;
     m_audio_spec.format = AUDIO_S16SYS;
     m_audio_spec.channels = 1;
-    m_audio_spec.samples = SOUND_BUFFER_SIZE;
     m_audio_spec.userdata = NULL;
     m_audio_spec.callback = audio_callback;
 
+    m_audio_consumer = m_wav_file != NULL;
+    if (p8_is_headless() || m_wav_file)
+        return;
+
+    const int latency = SAMPLE_RATE * m_latency_ms / 1000;
+    m_audio_spec.samples = device_buffer_size(latency);
+
     int ret = SDL_OpenAudio(&m_audio_spec, &m_audio_spec);
 
     if (ret != 0)
     {
         printf("Error on SDL_OpenAudio()\n");
+        return;
     }
 
+    // The device may not give the buffer size asked for; the ring still
+    // needs room for a whole callback.
+    int device_samples = m_audio_spec.samples;
+    m_mix_target = MIN(MAX(latency - device_samples, device_samples + MIX_BLOCK_SIZE), MIX_RING_SIZE);
+    atomic_store(&m_mix_quit, false);
+    m_mix_wake = SDL_CreateSemaphore(0);
+    if (m_mix_wake)
+        m_mix_thread = SDL_CreateThread(mix_thread, "p8_mixer", NULL);
+    if (!m_mix_thread)
+    {
+        printf("Error creating the audio mixer thread; mixing in the callback\n");
+        m_mix_target = 0;
+    }
+
+    m_audio_consumer = true;
     SDL_PauseAudio(0);
 #endif
 }
@@ -237,76 +454,293 @@ void audio_close()
     *(uint16_t *)_DA_CONTROL = 0;
 #else
     SDL_CloseAudio();
+    m_audio_consumer = false;
+    if (m_mix_thread)
+    {
+        atomic_store(&m_mix_quit, true);
+        SDL_SemPost(m_mix_wake);
+        SDL_WaitThread(m_mix_thread, NULL);
+        m_mix_thread = NULL;
+        m_mix_target = 0;
+    }
+    if (m_mix_wake)
+    {
+        SDL_DestroySemaphore(m_mix_wake);
+        m_mix_wake = NULL;
+    }
+    if (m_wav_file)
+        close_wav();
 #endif
 }
 
-void audio_sound(int32_t index, int32_t channel, uint32_t start, uint32_t length)
+void audio_set_latency(unsigned ms)
 {
 #ifdef NEXTP8
-    *(volatile uint8_t *)_P8AUDIO_HWFX40 = *(uint8_t *)(m_memory + 0x5f40);
-    *(volatile uint8_t *)_P8AUDIO_HWFX41 = *(uint8_t *)(m_memory + 0x5f41);
-    *(volatile uint8_t *)_P8AUDIO_HWFX42 = *(uint8_t *)(m_memory + 0x5f42);
-    *(volatile uint8_t *)_P8AUDIO_HWFX43 = *(uint8_t *)(m_memory + 0x5f43);
-    *(volatile uint16_t *)_P8AUDIO_SFX_LEN = length & 0x3f;
-    /* Bit 15 is the trigger bit; without it the RTL ignores the write. */
-    *(volatile uint16_t *)_P8AUDIO_SFX_CMD = 0x8000 | (index & 0x3f) | ((channel & 0x7) << 12) | ((start & 0x3f) << 6);
+    (void)ms;
 #else
-    soundcommand_t sound_command;
-    sound_command.sound_mode = SOUNDMODE_SOUND;
-    sound_command.sound.index = index;
-    sound_command.sound.channel = channel;
-    sound_command.sound.start = start;
-    sound_command.sound.end = start + length;
+    m_latency_ms = MIN(MAX(ms, AUDIO_MIN_LATENCY_MS), AUDIO_MAX_LATENCY_MS);
+#endif
+}
+
+int audio_open_wav(const char *file_name)
+{
+#ifdef NEXTP8
+    (void)file_name;
+    fputs("WAV output is not supported\n", stderr);
+    return 1;
+#else
+    FILE *fp = fopen(file_name, "wb");
+    if (!fp) {
+        fprintf(stderr, "Cannot open WAV output %s\n", file_name);
+        return 1;
+    }
+    // Rewritten with the real length when audio closes.
+    if (write_wav_header(fp, 0) != 0) {
+        fclose(fp);
+        return 1;
+    }
+    m_wav_file = fp;
+    return 0;
+#endif
+}
+
+void audio_render_frame(unsigned fps)
+{
+#ifndef NEXTP8
+    if (!m_wav_file)
+        return;
 
-    if (index == -1)
+    // Spread the remainder so each second gets exactly SAMPLE_RATE samples.
+    m_wav_frame_remainder += SAMPLE_RATE;
+    unsigned samples = m_wav_frame_remainder / fps;
+    m_wav_frame_remainder %= fps;
+
+    int16_t block[SOUND_BUFFER_SIZE];
+    uint8_t bytes[SOUND_BUFFER_SIZE * sizeof(int16_t)];
+    while (samples > 0) {
+        unsigned length = MIN(samples, SOUND_BUFFER_SIZE);
+        p8_clock_t start = p8_clock();
+        mix(block, length);
+        m_wav_render_time += p8_clock_delta(start, p8_clock());
+        atomic_fetch_add_explicit(&m_play_position, length, memory_order_release);
+
+        for (unsigned i = 0; i < length; i++)
+            put_le16(bytes + i * 2, (uint16_t)block[i]);
+        fwrite(bytes, sizeof(int16_t), length, m_wav_file);
+        m_wav_samples += length;
+        samples -= length;
+    }
+#else
+    (void)fps;
+#endif
+}
+
+#ifndef NEXTP8
+static void decode_sfx(sfx_t *sfx, const uint8_t *data)
+{
+    for (int i = 0; i < SFX_NOTE_COUNT; i++)
     {
-        if (channel >= 0 && channel < CHANNEL_COUNT)
-            m_channels[channel].sound_mode = SOUNDMODE_NONE;
+        uint16_t data16 = (uint16_t)((data[i * 2 + 1] << 8) | data[i * 2]);
+        sfxnote_t *note = &sfx->notes[i];
+        note->pitch = data16 & PITCH_MASK;
+        note->slide_from = i > 0 ? sfx->notes[i - 1].pitch : note->pitch;
+        note->waveform = (data16 & WAVEFORM_MASK) >> WAVEFORM_SHIFT;
+        note->volume = (data16 & VOLUME_MASK) >> VOLUME_SHIFT;
+        note->effect = (data16 & EFFECT_MASK) >> EFFECT_SHIFT;
+        note->custom = (data16 & CUSTOM_MASK) != 0;
     }
-    else if (index >= 0 && index <= SOUND_COUNT)
+    sfx->filters = data[64];
+    sfx->speed = data[65];
+    sfx->loop_start = data[66];
+    sfx->loop_end = data[67];
+    sfx->sample_per_tick = (SAMPLE_RATE / 128) * (sfx->speed + 1);
+}
+
+static void decode_pattern(pattern_t *pattern, const uint8_t *data)
+{
+    for (int i = 0; i < CHANNEL_COUNT; i++)
     {
-        uint8_t speed = m_memory[MEMORY_SFX + 68 * index + 64 + 1];
-        int sample_per_tick = (SAMPLE_RATE / 128) * (speed + 1);
+        bool enabled = (data[i] & (1 << 6)) == 0;
+        pattern->sound_index[i] = enabled ? (int8_t)(data[i] & 0x3F) : -1;
+    }
+    pattern->loop_begin = data[0] & (1 << 7);
+    pattern->loop_end = data[1] & (1 << 7);
+    pattern->stop = data[2] & (1 << 7);
+}
 
-        if (channel == -2)
+static void start_pattern(soundstate_t *channels, const pattern_t *pattern)
+{
+    for (int i = 0; i < CHANNEL_COUNT; i++)
+    {
+        if (pattern->sound_index[i] >= 0)
+        {
+            channels[i].sound_mode = SOUNDMODE_MUSIC;
+            channels[i].sound_index = pattern->sound_index[i];
+            channels[i].sample = 0;
+            channels[i].position = 0;
+            channels[i].end = 31;
+        }
+        else
+        {
+            channels[i].sound_mode = SOUNDMODE_NONE;
+        }
+    }
+}
+
+static void apply_sound_command(soundstate_t *channels, musicstate_t *music_state, const soundbank_t *bank, soundcommand_t *sound_command)
+{
+    if (sound_command->sound_mode == SOUNDMODE_SOUND)
+    {
+        sound_t *sound = &sound_command->sound;
+
+        if (sound->index == -1)
+        {
+            if (sound->channel >= 0 && sound->channel < CHANNEL_COUNT)
+                channels[sound->channel].sound_mode = SOUNDMODE_NONE;
+            return;
+        }
+        else if (sound->index == -2)
+            return;
+        else if (sound->channel == -2)
         {
             for (int i = 0; i < CHANNEL_COUNT; i++)
             {
-                soundstate_t *state = &m_channels[i];
-                if (state->sound_index == index)
-                    state->sound_mode = SOUNDMODE_NONE;
+                soundstate_t *channel = &channels[i];
+
+                if (channel->sound_index == sound->index)
+                    channel->sound_mode = SOUNDMODE_NONE;
             }
+            return;
         }
-        else if (channel == -1)
+        else if (sound->channel == -1)
         {
             for (int i = 0; i < CHANNEL_COUNT; i++)
             {
-                if (m_channels[i].sound_mode == SOUNDMODE_NONE)
+                if (channels[i].sound_mode == SOUNDMODE_NONE)
                 {
-                    channel = i;
+                    sound->channel = i;
                     break;
                 }
             }
         }
+        if (sound->channel >= 0 && sound->channel < CHANNEL_COUNT && sound->index >= 0 && sound->index < SOUND_COUNT)
+        {
+            soundstate_t *channel = &channels[sound->channel];
+            int sample_per_tick = bank->sfx[sound->index].sample_per_tick;
+            channel->sound_mode = SOUNDMODE_SOUND;
+            channel->sound_index = sound->index;
+            channel->end = sound->end;
+            channel->sample = sound->start;
+            channel->position = sound->start * sample_per_tick;
+        }
+    }
+    else if (sound_command->sound_mode == SOUNDMODE_MUSIC)
+    {
+        music_t *music = &sound_command->music;
 
-        if (channel >= 0 && channel < CHANNEL_COUNT)
+        if (music->index == -1)
+        {
+            for (int i = 0; i < CHANNEL_COUNT; i++)
+                channels[i].sound_mode = SOUNDMODE_NONE;
+            music_state->pattern = -1;
+            music_state->channel_mask = 0;
+        }
+        else if (music->index >= 0 && music->index < MUSIC_COUNT)
         {
-            soundstate_t *state = &m_channels[channel];
-            state->sound_mode = SOUNDMODE_SOUND;
-            state->sound_index = index;
-            state->sample = start;
-            state->end = start + length;
-            state->position = start * sample_per_tick;
+            music_state->pattern = music->index;
+            music_state->channel_mask = music->mask;
+            start_pattern(channels, &bank->patterns[music->index]);
         }
     }
+}
+
+// The channel state stat() reports. Lua thread only.
+static const soundstatus_t *sound_status(void)
+{
+    if (atomic_load_explicit(&m_status_shared, memory_order_relaxed) & STATUS_FRESH)
+    {
+        m_status_read = atomic_exchange(&m_status_shared, m_status_read) & ~STATUS_FRESH;
+        if (m_sound_status[m_status_read].commands == m_commands_sent)
+            m_status_shadow = m_sound_status[m_status_read];
+    }
+    return &m_status_shadow;
+}
 
-#ifndef OS_BAREMETAL
-    pthread_mutex_lock(&m_sound_queue_mutex);
+// Queue a command for the audio thread. Lua thread only.
+static void send_sound_command(soundcommand_t *sound_command)
+{
+    // Catch up first, so that a free channel is picked from recent state.
+    sound_status();
+    // A command the queue has no room for still shows in stat() until the
+    // audio thread next publishes. With no audio thread, as when headless,
+    // the shadow is all there is.
+    if (m_audio_consumer && ring_push(&m_sound_queue, sound_command))
+        m_commands_sent++;
+    apply_sound_command(m_status_shadow.channels, &m_status_shadow.music, &m_sound_banks[m_bank_latest], sound_command);
+}
+
+// Audio thread only.
+static void publish_sound_status(void)
+{
+    soundstatus_t *status = &m_sound_status[m_status_write];
+    memcpy(status->channels, m_channels, sizeof(status->channels));
+    status->music = m_music_state;
+    status->commands = m_commands_applied;
+    m_status_write = atomic_exchange(&m_status_shared, m_status_write | STATUS_FRESH) & ~STATUS_FRESH;
+}
 #endif
-    queue_add_back(&m_sound_queue, &sound_command);
-#ifndef OS_BAREMETAL
-    pthread_mutex_unlock(&m_sound_queue_mutex);
+
+void audio_sync_sound_ram()
+{
+#ifndef NEXTP8
+    if (!m_sfx_dirty && !m_music_dirty)
+        return;
+
+    // The write bank is two publications old, so start from the latest.
+    soundbank_t *bank = &m_sound_banks[m_bank_write];
+    memcpy(bank, &m_sound_banks[m_bank_latest], sizeof(*bank));
+
+    for (int i = 0; i < SOUND_COUNT; i++)
+        if (m_sfx_dirty & (UINT64_C(1) << i))
+            decode_sfx(&bank->sfx[i], m_memory + MEMORY_SFX + MEMORY_SFX_ENTRY_SIZE * i);
+    if (m_music_dirty)
+        for (int i = 0; i < MUSIC_COUNT; i++)
+            decode_pattern(&bank->patterns[i], m_memory + MEMORY_MUSIC + MUSIC_ENTRY_SIZE * i);
+    m_sfx_dirty = 0;
+    m_music_dirty = false;
+
+    m_bank_latest = m_bank_write;
+    m_bank_write = atomic_exchange(&m_bank_shared, m_bank_write | BANK_FRESH) & ~BANK_FRESH;
 #endif
+}
+
+void audio_sound(int32_t index, int32_t channel, uint32_t start, uint32_t length)
+{
+#ifdef NEXTP8
+    *(volatile uint8_t *)_P8AUDIO_HWFX40 = *(uint8_t *)(m_memory + 0x5f40);
+    *(volatile uint8_t *)_P8AUDIO_HWFX41 = *(uint8_t *)(m_memory + 0x5f41);
+    *(volatile uint8_t *)_P8AUDIO_HWFX42 = *(uint8_t *)(m_memory + 0x5f42);
+    *(volatile uint8_t *)_P8AUDIO_HWFX43 = *(uint8_t *)(m_memory + 0x5f43);
+    *(volatile uint16_t *)_P8AUDIO_SFX_LEN = length & 0x3f;
+    /* Bit 15 is the trigger bit; without it the RTL ignores the write. */
+    *(volatile uint16_t *)_P8AUDIO_SFX_CMD = 0x8000 | (index & 0x3f) | ((channel & 0x7) << 12) | ((start & 0x3f) << 6);
+#else
+    // Publish the notes before the command that plays them.
+    audio_sync_sound_ram();
+
+    if (start > SFX_NOTE_COUNT)
+        start = SFX_NOTE_COUNT;
+    if (length > SFX_NOTE_COUNT - start)
+        length = SFX_NOTE_COUNT - start;
+
+    soundcommand_t sound_command;
+    sound_command.sound_mode = SOUNDMODE_SOUND;
+    sound_command.sound.index = index;
+    sound_command.sound.channel = channel;
+    sound_command.sound.start = start;
+    sound_command.sound.end = start + length;
+
+    send_sound_command(&sound_command);
 #endif
 }
 
@@ -320,50 +754,15 @@ void audio_music(int32_t index, int32_t fadems, int32_t mask)
     *(volatile uint16_t *)_P8AUDIO_MUSIC_FADE = (fadems * 2205 / 1000) & 0xffff;
     *(volatile uint16_t *)_P8AUDIO_MUSIC_CMD = ((index & 0x3f) << 7) | ((mask & 0xf) << 3);
 #else
+    audio_sync_sound_ram();
+
     soundcommand_t sound_command;
     sound_command.sound_mode = SOUNDMODE_MUSIC;
     sound_command.music.index = index;
     sound_command.music.fadems = fadems;
     sound_command.music.mask = mask;
 
-    if (index == -1)
-    {
-        for (int i = 0; i < CHANNEL_COUNT; i++)
-            m_channels[i].sound_mode = SOUNDMODE_NONE;
-        m_music_state.pattern = -1;
-        m_music_state.channel_mask = 0;
-    }
-    else
-    {
-        m_music_state.pattern = index;
-        m_music_state.channel_mask = mask;
-
-        for (int i = 0; i < CHANNEL_COUNT; i++)
-        {
-            uint8_t channel_data = m_memory[MEMORY_MUSIC + 4 * m_music_state.pattern + i];
-            bool enabled = (channel_data & (1 << 6)) == 0;
-            if (enabled)
-            {
-                m_channels[i].sound_mode = SOUNDMODE_MUSIC;
-                m_channels[i].sound_index = channel_data & 0x7F;
-                m_channels[i].sample = 0;
-                m_channels[i].position = 0;
-                m_channels[i].end = 31;
-            }
-            else
-            {
-                m_channels[i].sound_mode = SOUNDMODE_NONE;
-            }
-        }
-    }
-
-#ifndef OS_BAREMETAL
-    pthread_mutex_lock(&m_sound_queue_mutex);
-#endif
-    queue_add_back(&m_sound_queue, &sound_command);
-#ifndef OS_BAREMETAL
-    pthread_mutex_unlock(&m_sound_queue_mutex);
-#endif
+    send_sound_command(&sound_command);
 #endif
 }
 
@@ -375,61 +774,64 @@ int32_t audio_stat(int32_t index)
     else if (index >= 16 && index <= 26)
         return *(volatile int16_t *)(_P8AUDIO_STAT46 + (index - 16) * 2);
 #else
+    const soundstatus_t *status = sound_status();
+    const soundstate_t *channels = status->channels;
+
     if (index >= 16 && index <= 19)
     {
         int channel = index - 16;
-        if (m_channels[channel].sound_mode == SOUNDMODE_NONE)
+        if (channels[channel].sound_mode == SOUNDMODE_NONE)
             return -1;
-        return m_channels[channel].sound_index;
+        return channels[channel].sound_index;
     }
     if (index >= 20 && index <= 23) {
         int channel = index - 20;
-        if (m_channels[channel].sound_mode == SOUNDMODE_NONE)
+        if (channels[channel].sound_mode == SOUNDMODE_NONE)
             return -1;
-        return m_channels[channel].position;
+        return channels[channel].position;
     }
     if (index >= 46 && index <= 49) {
         int channel = index - 46;
-        if (m_channels[channel].sound_mode == SOUNDMODE_NONE)
+        if (channels[channel].sound_mode == SOUNDMODE_NONE)
             return -1;
-        return m_channels[channel].sound_index;
+        return channels[channel].sound_index;
     }
     if (index >= 50 && index <= 53) {
         int channel = index - 50;
-        if (m_channels[channel].sound_mode == SOUNDMODE_NONE)
+        if (channels[channel].sound_mode == SOUNDMODE_NONE)
             return -1;
-        return m_channels[channel].position;
+        return channels[channel].position;
     }
     if (index == 24 || index == 54) {
         bool any_music = false;
         for (int i = 0; i < CHANNEL_COUNT; ++i) {
-            if (m_channels[i].sound_mode == SOUNDMODE_MUSIC) {
+            if (channels[i].sound_mode == SOUNDMODE_MUSIC) {
                 any_music = true;
                 break;
             }
         }
-        return any_music ? m_music_state.pattern : -1;
+        return any_music ? status->music.pattern : -1;
     }
     if (index == 25 || index == 55) {
         bool any_music = false;
         for (int i = 0; i < CHANNEL_COUNT; ++i) {
-            if (m_channels[i].sound_mode == SOUNDMODE_MUSIC) {
+            if (channels[i].sound_mode == SOUNDMODE_MUSIC) {
                 any_music = true;
                 break;
             }
         }
-        return any_music ? m_music_state.pattern : -1;
+        return any_music ? status->music.pattern : -1;
     }
     if (index == 26 || index == 56) {
         int ticks = 0;
         for (int i = 0; i < CHANNEL_COUNT; ++i)
-            if (m_channels[i].sound_mode == SOUNDMODE_MUSIC)
-                ticks = MAX(ticks, m_channels[i].sample);
+            if (channels[i].sound_mode == SOUNDMODE_MUSIC)
+                ticks = MAX(ticks, channels[i].sample);
         return ticks;
     }
     if (index == 57) {
         for (int i = 0; i < CHANNEL_COUNT; ++i) {
-            if (m_channels[i].sound_mode == SOUNDMODE_MUSIC)
+            if (channels[i].sound_mode == SOUNDMODE_MUSIC)
                 return 1;
         }
         return 0;
@@ -439,7 +841,15 @@ int32_t audio_stat(int32_t index)
 }
 
 #ifndef NEXTP8
-void update_channel(soundstate_t *channel)
+// Pick up sound RAM published since the last call. Audio thread only.
+static const soundbank_t *acquire_sound_bank(void)
+{
+    if (atomic_load_explicit(&m_bank_shared, memory_order_relaxed) & BANK_FRESH)
+        m_bank_read = atomic_exchange(&m_bank_shared, m_bank_read) & ~BANK_FRESH;
+    return &m_sound_banks[m_bank_read];
+}
+
+void update_channel(const soundbank_t *bank, soundstate_t *channel)
 {
     if (channel->sound_mode == SOUNDMODE_NONE)
         return;
@@ -448,41 +858,21 @@ void update_channel(soundstate_t *channel)
     {
         if (channel->sample >= channel->end)
         {
-            bool is_loop_begin = m_memory[MEMORY_MUSIC + 4 * m_music_state.pattern] & (1 << 7);
-            bool is_loop_end = m_memory[MEMORY_MUSIC + 4 * m_music_state.pattern + 1] & (1 << 7);
-            bool is_stop = m_memory[MEMORY_MUSIC + 4 * m_music_state.pattern + 2] & (1 << 7);
-            if (is_stop)
+            const pattern_t *pattern = &bank->patterns[m_music_state.pattern];
+            if (pattern->stop)
             {
+                channel->sound_mode = SOUNDMODE_NONE;
                 return;
             }
             m_music_state.pattern++;
-            if (is_loop_end || m_music_state.pattern == MUSIC_COUNT)
+            if (pattern->loop_end || m_music_state.pattern == MUSIC_COUNT)
             {
                 int i = m_music_state.pattern - 1;
-                while (i >= 0)
-                {
-                    is_loop_begin = (m_memory[MEMORY_MUSIC + 4 * i] & (1 << 7));
-                    if (is_loop_begin || i == 0)
-                        break;
+                while (i > 0 && !bank->patterns[i].loop_begin)
                     i--;
-                }
                 m_music_state.pattern = i;
             }
-            for (int i = 0; i < CHANNEL_COUNT; i++)
-            {
-                uint8_t channel_data = m_memory[MEMORY_MUSIC + 4 * m_music_state.pattern + i];
-                bool enabled = (channel_data & (1 << 6)) == 0;
-                if (enabled)
-                {
-                    m_channels[i].sound_mode = SOUNDMODE_MUSIC;
-                    m_channels[i].sound_index = channel_data & 0x7F;
-                    m_channels[i].sample = 0;
-                    m_channels[i].position = 0;
-                    m_channels[i].end = 31;
-                }
-                else
-                    m_channels[i].sound_mode = SOUNDMODE_NONE;
-            }
+            start_pattern(m_channels, &bank->patterns[m_music_state.pattern]);
         }
     }
     else if (channel->sound_mode == SOUNDMODE_SOUND)
@@ -494,97 +884,15 @@ void update_channel(soundstate_t *channel)
 
 void update_sound_queue()
 {
-#ifndef OS_BAREMETAL
-    pthread_mutex_lock(&m_sound_queue_mutex);
-#endif
-
     soundcommand_t sound_command;
 
-    while (queue_get_front(&m_sound_queue, &sound_command))
+    while (ring_pop(&m_sound_queue, &sound_command))
     {
-        if (sound_command.sound_mode == SOUNDMODE_SOUND)
-        {
-            sound_t *sound = &sound_command.sound;
-
-            if (sound->index == -1)
-            {
-                if (sound->channel >= 0 && sound->channel <= CHANNEL_COUNT)
-                    m_channels[sound->channel].sound_mode = SOUNDMODE_NONE;
-                continue;
-            }
-            else if (sound->index == -2)
-                continue;
-            else if (sound->channel == -2)
-            {
-                for (int i = 0; i < CHANNEL_COUNT; i++)
-                {
-                    soundstate_t *channel = &m_channels[i];
-
-                    if (channel->sound_index == sound->index)
-                        channel->sound_mode = SOUNDMODE_NONE;
-                }
-                continue;
-            }
-            else if (sound->channel == -1)
-            {
-                for (int i = 0; i < CHANNEL_COUNT; i++)
-                {
-                    if (m_channels[i].sound_mode == SOUNDMODE_NONE)
-                    {
-                        sound->channel = i;
-                        break;
-                    }
-                }
-            }
-            if (sound->channel >= 0 && sound->channel < CHANNEL_COUNT && sound->index >= 0 && sound->index <= SOUND_COUNT)
-            {
-                soundstate_t *channel = &m_channels[sound->channel];
-                uint8_t speed = m_memory[MEMORY_SFX + 68 * sound->index + 64 + 1];
-                int sample_per_tick = (SAMPLE_RATE / 128) * (speed + 1);
-                channel->sound_mode = SOUNDMODE_SOUND;
-                channel->sound_index = sound->index;
-                channel->end = sound->end;
-                channel->sample = sound->start;
-                channel->position = sound->start * sample_per_tick;
-            }
-        }
-        else if (sound_command.sound_mode == SOUNDMODE_MUSIC)
-        {
-            music_t *music = &sound_command.music;
-
-            if (music->index == -1)
-            {
-                for (int i = 0; i < CHANNEL_COUNT; i++)
-                    m_channels[i].sound_mode = SOUNDMODE_NONE;
-            }
-            else
-            {
-                m_music_state.pattern = music->index;
-                m_music_state.channel_mask = music->mask;
-                for (int i = 0; i < CHANNEL_COUNT; i++)
-                {
-                    uint8_t channel_data = m_memory[MEMORY_MUSIC + 4 * m_music_state.pattern + i];
-                    bool enabled = (channel_data & (1 << 6)) == 0;
-                    if (enabled)
-                    {
-                        m_channels[i].sound_mode = SOUNDMODE_MUSIC;
-                        m_channels[i].sound_index = channel_data & 0x7F;
-                        m_channels[i].sample = 0;
-                        m_channels[i].position = 0;
-                        m_channels[i].end = 31;
-                    }
-                    else
-                    {
-                        m_channels[i].sound_mode = SOUNDMODE_NONE;
-                    }
-                }
-            }
-        }
+        // Each command is pushed after the sound RAM it plays is published.
+        const soundbank_t *bank = acquire_sound_bank();
+        apply_sound_command(m_channels, &m_music_state, bank, &sound_command);
+        m_commands_applied++;
     }
-
-#ifndef OS_BAREMETAL
-    pthread_mutex_unlock(&m_sound_queue_mutex);
-#endif
 }
 
 float get_frequency(int pitch)
@@ -592,47 +900,25 @@ float get_frequency(int pitch)
     return m_tone_frequencies[pitch % 12] / 2 * (1 << (pitch / 12));
 }
 
-void render_sound(int waveform, int pitch, int volume, int position, int offset, int length, int16_t *buffer)
+void render_sound(int waveform, int pitch, int volume, dsp_osc_t *osc, int offset, int length, int16_t *buffer)
 {
     int16_t amplitude = (int16_t)((MAX_VOLUME / 8) * volume);
-    unsigned int frequency = (unsigned int)get_frequency(pitch);
-    switch (waveform)
-    {
-    case WAVEFORM_TRIANGLE:
-        dsp_triangle_wave(frequency, amplitude, 0, position, offset, length, buffer);
-        break;
-    case WAVEFORM_TILTEDSAW:
-        dsp_tilted_sawtooth_wave(frequency, amplitude, 0, 0.85f, position, offset, length, buffer);
-        break;
-    case WAVEFORM_SAW:
-        dsp_sawtooth_wave(frequency, amplitude, 0, position, offset, length, buffer);
-        break;
-    case WAVEFORM_SQUARE:
-        dsp_square_wave(frequency, amplitude, 0, position, offset, length, buffer);
-        break;
-    case WAVEFORM_PULSE:
-        dsp_pulse_wave(frequency, amplitude, 0, 1.0f / 3.0f, position, offset, length, buffer);
-        break;
-    case WAVEFORM_ORGAN:
-        dsp_organ_wave(frequency, amplitude, 0, 0.5f, position, offset, length, buffer);
-        break;
-    case WAVEFORM_NOISE:
-        dsp_noise(frequency, amplitude, position, offset, length, buffer);
-        break;
-    case WAVEFORM_PHASER:
-        break;
-    }
+    dsp_render(waveform, osc, m_pitch_steps[pitch], amplitude, length, buffer + offset);
 }
 
 void render_sounds(int16_t *buffer, int total_samples)
 {
     update_sound_queue();
+    const soundbank_t *bank = acquire_sound_bank();
 
     memset(buffer, 0, sizeof(int16_t) * total_samples);
 
     // 0x5f2f == 1: audio engine is paused
     if (m_memory[MEMORY_AUDIO_PAUSE] == 1)
+    {
+        publish_sound_status();
         return;
+    }
 
     for (int i = 0; i < CHANNEL_COUNT; i++)
     {
@@ -640,46 +926,30 @@ void render_sounds(int16_t *buffer, int total_samples)
 
         if ((channel->sound_mode == SOUNDMODE_MUSIC && m_music_enabled) || (channel->sound_mode == SOUNDMODE_SOUND && m_sound_enabled))
         {
-            // uint8_t editor_mode = m_memory[MEMORY_SFX + 68 * channel->sound_index + 64];
-            uint8_t speed = m_memory[MEMORY_SFX + 68 * channel->sound_index + 64 + 1];
-            // uint8_t loop_start = m_memory[MEMORY_SFX + 68 * channel->sound_index + 64 + 2];
-            // uint8_t loop_end = m_memory[MEMORY_SFX + 68 * channel->sound_index + 64 + 3];
-            int sample_per_tick = (SAMPLE_RATE / 128) * (speed + 1);
             int index = 0;
 
-            while (index < total_samples)
+            while (index < total_samples && channel->sound_mode != SOUNDMODE_NONE && channel->sample < SFX_NOTE_COUNT)
             {
-                uint8_t data_lo = m_memory[MEMORY_SFX + 68 * channel->sound_index + channel->sample * 2];
-                uint8_t data_hi = m_memory[MEMORY_SFX + 68 * channel->sound_index + channel->sample * 2 + 1];
-                uint16_t data = (uint16_t)((data_hi << 8) | data_lo);
-                // bool use_sfx = data & 0x8000;
-                uint8_t effect = (data & EFFECT_MASK) >> EFFECT_SHIFT;
-                uint8_t volume = (data & VOLUME_MASK) >> VOLUME_SHIFT;
-                uint8_t waveform = (data & WAVEFORM_MASK) >> WAVEFORM_SHIFT;
-                uint8_t pitch = data & PITCH_MASK;
+                // Looked up per note: a new music pattern can change the SFX.
+                const sfx_t *sfx = &bank->sfx[channel->sound_index];
+                const sfxnote_t *note = &sfx->notes[channel->sample];
+                int sample_per_tick = sfx->sample_per_tick;
+                int pitch = note->pitch;
+                int volume = note->volume;
 
                 int length = MIN(total_samples - index, sample_per_tick - (channel->position % sample_per_tick));
 
                 /* Apply effect: compute modified pitch and volume */
                 int eff_pitch = pitch;
                 int eff_volume = volume;
-                if (effect != EFFECT_NONE)
+                if (note->effect != EFFECT_NONE)
                 {
                     float t = (float)(channel->position % sample_per_tick) / (float)sample_per_tick;
-                    switch (effect)
+                    switch (note->effect)
                     {
                     case EFFECT_SLIDE:
-                    {
-                        int prev_pitch = pitch;
-                        if (channel->sample > 0)
-                        {
-                            uint8_t plo = m_memory[MEMORY_SFX + 68 * channel->sound_index + (channel->sample - 1) * 2];
-                            uint8_t phi = m_memory[MEMORY_SFX + 68 * channel->sound_index + (channel->sample - 1) * 2 + 1];
-                            prev_pitch = ((uint16_t)((phi << 8) | plo)) & PITCH_MASK;
-                        }
-                        eff_pitch = (int)(prev_pitch + (pitch - prev_pitch) * t);
-                    }
-                    break;
+                        eff_pitch = (int)(note->slide_from + (pitch - note->slide_from) * t);
+                        break;
                     case EFFECT_VIBRATO:
                         eff_pitch = pitch + (int)(sinf(t * 2.0f * PI) * 1.0f);
                         break;
@@ -713,50 +983,54 @@ void render_sounds(int16_t *buffer, int total_samples)
                     if (eff_volume > 7) eff_volume = 7;
                 }
 
-                render_sound(waveform, eff_pitch, eff_volume, channel->position, index, length, buffer);
+                render_sound(note->waveform, eff_pitch, eff_volume, &channel->osc, index, length, buffer);
 
                 index += length;
                 channel->position += length;
                 channel->sample = channel->position / sample_per_tick;
 
-                update_channel(channel);
+                update_channel(bank, channel);
             }
         }
     }
 
+    publish_sound_status();
+
     const bool dampen_enabled = (m_memory[MEMORY_MISCFLAGS] & 0x20) == 0;
+    int last_pcm = -1;
 
     for (int i = 0; i < total_samples; i++)
     {
-        if (m_pcm_buffered > 0)
+        // Each PCM byte plays for 8 output samples.
+        if (m_pcm_repeat == 0 && !ring_pop(&m_pcm_ring, &m_pcm_sample))
         {
-            uint8_t pcm_sample = m_pcm_buffer[m_pcm_read_pos];
-            int16_t sample16 = (int16_t)((pcm_sample - 128) * 256);
+            m_pcm_dampen = 0;
+            continue;
+        }
 
-            if (dampen_enabled)
-            {
-                m_pcm_dampen = (sample16 + m_pcm_dampen * 3) / 4;
-                buffer[i] = (int16_t)(buffer[i] + m_pcm_dampen);
-            }
-            else
-            {
-                buffer[i] = (int16_t)(buffer[i] + sample16);
-            }
+        int16_t sample16 = (int16_t)((m_pcm_sample - 128) * 256);
 
-            m_pcm_repeat++;
-            if (m_pcm_repeat >= 8)
-            {
-                m_pcm_repeat = 0;
-                m_pcm_read_pos = (m_pcm_read_pos + 1) % PCM_BUFFER_SIZE;
-                m_pcm_buffered--;
-            }
+        if (dampen_enabled)
+        {
+            m_pcm_dampen = (sample16 + m_pcm_dampen * 3) / 4;
+            buffer[i] = (int16_t)(buffer[i] + m_pcm_dampen);
         }
         else
         {
-            m_pcm_repeat = 0;
-            m_pcm_dampen = 0;
+            buffer[i] = (int16_t)(buffer[i] + sample16);
         }
+
+        m_pcm_repeat = (m_pcm_repeat + 1) % 8;
+        last_pcm = i;
     }
+
+    if (last_pcm >= 0)
+    {
+        // The PCM byte being played runs on into the next block.
+        unsigned end = m_mix_position + last_pcm + 1 + (m_pcm_repeat ? 8 - m_pcm_repeat : 0);
+        atomic_store_explicit(&m_pcm_end_position, end, memory_order_release);
+    }
+    m_mix_position += total_samples;
 }
 #endif
 
@@ -781,15 +1055,8 @@ void audio_pcm_write(unsigned address, unsigned length)
         m_pcm_write_pos = (m_pcm_write_pos + 1) % PCM_BUFFER_SIZE;
     }
 #else
-    if (length > PCM_BUFFER_SIZE - m_pcm_buffered)
-        length = PCM_BUFFER_SIZE - m_pcm_buffered;
-
-    for (uint32_t i = 0; i < length; i++)
-    {
-        m_pcm_buffer[m_pcm_write_pos] = m_memory[address + i];
-        m_pcm_write_pos = (m_pcm_write_pos + 1) % PCM_BUFFER_SIZE;
-        m_pcm_buffered++;
-    }
+    if (m_audio_consumer)
+        ring_write(&m_pcm_ring, m_memory + address, length);
 #endif
 #endif
 }
@@ -808,7 +1075,13 @@ int16_t audio_pcm_buffered()
     
     return buffered;
 #else
-    return m_pcm_buffered;
+    // PCM the mixer has already taken but that has not been played yet is
+    // still buffered, as far as the cart is concerned.
+    int pending = (int)(atomic_load_explicit(&m_pcm_end_position, memory_order_acquire) -
+                        atomic_load_explicit(&m_play_position, memory_order_acquire));
+    if (pending < 0)
+        pending = 0;
+    return ring_count(&m_pcm_ring) + (pending + 7) / 8;
 #endif
 #else
     return 0;
@@ -817,11 +1090,32 @@ int16_t audio_pcm_buffered()
 
 int16_t audio_pcm_app_buffer()
 {
-#ifdef ENABLE_AUDIO
+#if defined(ENABLE_AUDIO) && !defined(NEXTP8)
+    // Enough to keep the mixer's lookahead fed as well.
+    return PCM_BUFFER_SIZE / 4 + (m_mix_target + 7) / 8;
+#elif defined(ENABLE_AUDIO)
     return PCM_BUFFER_SIZE / 4;
 #else
     return 0;
 #endif
 }
 
+unsigned audio_overflows()
+{
+#ifdef NEXTP8
+    return 0;
+#else
+    return ring_overflows(&m_sound_queue) + ring_overflows(&m_pcm_ring);
+#endif
+}
+
+unsigned audio_underruns()
+{
+#ifdef NEXTP8
+    return 0;
+#else
+    return atomic_load_explicit(&m_underruns, memory_order_relaxed);
+#endif
+}
+
 #endif
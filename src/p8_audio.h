@@ -21,6 +21,9 @@
 #define SOUND_COUNT 64
 #define MUSIC_COUNT 64
 #define SOUND_QUEUE_SIZE 8
+#define AUDIO_DEFAULT_LATENCY_MS 50
+#define AUDIO_MIN_LATENCY_MS 10
+#define AUDIO_MAX_LATENCY_MS 250
 
 void audio_init();
 void audio_resume();
@@ -29,9 +32,26 @@ void audio_close();
 void audio_sound(int32_t index, int32_t channel, uint32_t start, uint32_t end);
 void audio_music(int32_t index, int32_t fade_ms, int32_t mask);
 int32_t audio_stat(int32_t index);
+/* Hand sound RAM written since the last call to the audio thread. */
+void audio_sync_sound_ram();
+/**
+ * Render audio to a 16-bit mono WAV file instead of the audio device. Call
+ * before audio_init; the file is completed by audio_close.
+ *
+ * @return 0 on success, non-zero if the file cannot be written
+ */
+int audio_open_wav(const char *file_name);
+/* With WAV output, render the audio for one frame at fps frames per second. */
+void audio_render_frame(unsigned fps);
 void audio_pcm_write(unsigned address, unsigned length);
 int16_t audio_pcm_buffered();
 int16_t audio_pcm_app_buffer();
+/* Sound commands and PCM bytes dropped so far because the audio thread fell behind. */
+unsigned audio_overflows();
+/* Device callbacks so far that found less mixed audio than they needed. */
+unsigned audio_underruns();
+/* Target output latency in ms, clamped to the supported range. Call before audio_init. */
+void audio_set_latency(unsigned ms);
 #ifdef NEXTP8
 void audio_update();
 #endif
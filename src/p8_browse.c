@@ -239,6 +239,7 @@ static inline void screen_pixel(int x, int y, int col)
     if (x < overlay_clip_x0 || y < overlay_clip_y0 || x >= overlay_clip_x1 || y >= overlay_clip_y1)
         return;
     uint8_t *dest = m_memory + (m_memory[MEMORY_SCREEN_PHYS] << 8) + (x >> 1) + y * 64;
+    screen_mark_dirty_rows(y, y);
     if (x & 1)
         *dest = ((col & 0xF) << 4) | (*dest & 0x0F);
     else
@@ -264,6 +265,7 @@ static void draw_preview_label(const p8_dialog_t *dialog, void *user_data, int x
     int draw_h = height < PREVIEW_LABEL_DISPLAY_SIZE ? height : PREVIEW_LABEL_DISPLAY_SIZE;
     int ox = x + (width - draw_w) / 2;
     memset(m_memory + (m_memory[MEMORY_SCREEN_PHYS] << 8), 0, MEMORY_SCREEN_SIZE);
+    screen_mark_dirty_rows(0, P8_HEIGHT - 1);
     for (int dy = 0; dy < draw_h; dy++) {
         for (int dx = 0; dx < draw_w; dx++) {
             int px = ox + dx;
@@ -492,6 +494,7 @@ static void browse_hide(void)
 
     reset_color();
     memset(m_memory + (m_memory[MEMORY_SCREEN_PHYS] << 8), 0, MEMORY_SCREEN_SIZE);
+    screen_mark_dirty_rows(0, P8_HEIGHT - 1);
 }
 
 static void browse_update(void)
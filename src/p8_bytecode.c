@@ -0,0 +1,204 @@
+/**
+ * Copyright (C) 2026 Chris January
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "lua.h"
+#include "lauxlib.h"
+#include "p8_bytecode.h"
+#include "p8_emu.h"
+
+#define BYTECODE_PATH CACHE_PATH "/bytecode"
+
+/* Bump when the compiler changes in a way the Lua dump header does not show. */
+#define BYTECODE_FORMAT 2
+
+/* Largest body accepted, so a corrupt length cannot ask for a huge buffer. */
+#define BYTECODE_MAX_SIZE (4 * 1024 * 1024)
+
+#define FNV_OFFSET_BASIS UINT64_C(0xcbf29ce484222325)
+
+typedef struct {
+    char magic[4];
+    uint32_t format;
+    uint32_t script_length;
+    uint32_t hash_hi;
+    uint32_t hash_lo;
+    // The body is checked before it is loaded, because Lua does not verify
+    // bytecode and a damaged file could crash the VM.
+    uint32_t body_length;
+    uint32_t body_hash_hi;
+    uint32_t body_hash_lo;
+} bytecode_header_t;
+
+typedef struct {
+    FILE *fp;
+    uint64_t hash;
+    size_t length;
+} file_writer_t;
+
+static const char bytecode_magic[4] = { 'P', '8', 'B', 'C' };
+
+// 64-bit FNV-1a
+static uint64_t hash_bytes(uint64_t hash, const char *data, size_t length)
+{
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (uint8_t)data[i];
+        hash *= UINT64_C(0x100000001b3);
+    }
+    return hash;
+}
+
+static void make_header(bytecode_header_t *header, const char *script, size_t length, const char *chunk_name)
+{
+    // The chunk name is part of the key because it is stored in the
+    // bytecode and shows up in error messages.
+    uint64_t hash = FNV_OFFSET_BASIS;
+    hash = hash_bytes(hash, chunk_name, strlen(chunk_name) + 1);
+    hash = hash_bytes(hash, script, length);
+
+    memcpy(header->magic, bytecode_magic, sizeof(header->magic));
+    header->format = BYTECODE_FORMAT;
+    header->script_length = (uint32_t)length;
+    header->hash_hi = (uint32_t)(hash >> 32);
+    header->hash_lo = (uint32_t)hash;
+    header->body_length = 0;
+    header->body_hash_hi = 0;
+    header->body_hash_lo = 0;
+}
+
+static void set_body(bytecode_header_t *header, uint64_t hash, size_t length)
+{
+    header->body_length = (uint32_t)length;
+    header->body_hash_hi = (uint32_t)(hash >> 32);
+    header->body_hash_lo = (uint32_t)hash;
+}
+
+static void cache_file_name(char *buffer, size_t buffer_size, const bytecode_header_t *header)
+{
+    snprintf(buffer, buffer_size, "%s/%08x%08x.luac", BYTECODE_PATH,
+             (unsigned)header->hash_hi, (unsigned)header->hash_lo);
+}
+
+static int ensure_dir(const char *path)
+{
+    struct stat st;
+    if (stat(path, &st) == 0)
+        return S_ISDIR(st.st_mode) ? 0 : -1;
+    return MKDIR(path);
+}
+
+static int write_file(lua_State *L, const void *p, size_t size, void *data)
+{
+    (void)L;
+    file_writer_t *writer = (file_writer_t *)data;
+    writer->hash = hash_bytes(writer->hash, (const char *)p, size);
+    writer->length += size;
+    return fwrite(p, 1, size, writer->fp) != size;
+}
+
+// Read the body that follows the header, or NULL if it does not match the
+// length and hash recorded in the header.
+static char *read_body(FILE *fp, const bytecode_header_t *header)
+{
+    if (header->body_length == 0 || header->body_length > BYTECODE_MAX_SIZE)
+        return NULL;
+    char *body = malloc(header->body_length);
+    if (!body)
+        return NULL;
+    bool ok = fread(body, 1, header->body_length, fp) == header->body_length &&
+              fgetc(fp) == EOF;
+    if (ok) {
+        bytecode_header_t expected = *header;
+        set_body(&expected, hash_bytes(FNV_OFFSET_BASIS, body, header->body_length), header->body_length);
+        ok = memcmp(&expected, header, sizeof(expected)) == 0;
+    }
+    if (!ok) {
+        free(body);
+        return NULL;
+    }
+    return body;
+}
+
+int bytecode_cache_load(lua_State *L, const char *script, size_t length, const char *chunk_name)
+{
+    bytecode_header_t expected, header;
+    make_header(&expected, script, length, chunk_name);
+
+    char file_name[PATH_MAX];
+    cache_file_name(file_name, sizeof(file_name), &expected);
+    FILE *fp = fopen(file_name, "rb");
+    if (!fp)
+        return 1;
+
+    char *body = NULL;
+    // Everything up to the body checksum must match the script.
+    if (fread(&header, sizeof(header), 1, fp) == 1 &&
+        memcmp(&header, &expected, offsetof(bytecode_header_t, body_length)) == 0)
+        body = read_body(fp, &header);
+    fclose(fp);
+
+    // Only accept bytecode: the dump header also rejects files written by
+    // a build with a different Lua version or number format.
+    int status = LUA_ERRFILE;
+    if (body) {
+        status = luaL_loadbufferx(L, body, header.body_length, chunk_name, "b");
+        free(body);
+        if (status != LUA_OK)
+            lua_pop(L, 1);
+    }
+    if (status != LUA_OK) {
+        // Stale or damaged; it is written again once the script compiles.
+        unlink(file_name);
+        return 1;
+    }
+    return 0;
+}
+
+void bytecode_cache_store(lua_State *L, const char *script, size_t length, const char *chunk_name)
+{
+    if (ensure_dir(CACHE_PATH) != 0 || ensure_dir(BYTECODE_PATH) != 0)
+        return;
+
+    bytecode_header_t header;
+    make_header(&header, script, length, chunk_name);
+
+    char file_name[PATH_MAX];
+    char temp_file_name[PATH_MAX + 4];
+    cache_file_name(file_name, sizeof(file_name), &header);
+    snprintf(temp_file_name, sizeof(temp_file_name), "%s.tmp", file_name);
+
+    file_writer_t writer;
+    writer.fp = fopen(temp_file_name, "wb");
+    if (!writer.fp)
+        return;
+    writer.hash = FNV_OFFSET_BASIS;
+    writer.length = 0;
+    // The header is written again once the body checksum is known.
+    bool ok = fwrite(&header, sizeof(header), 1, writer.fp) == 1 &&
+              lua_dump(L, write_file, &writer) == 0;
+    if (ok) {
+        set_body(&header, writer.hash, writer.length);
+        ok = fseek(writer.fp, 0, SEEK_SET) == 0 &&
+             fwrite(&header, sizeof(header), 1, writer.fp) == 1;
+    }
+    if (fclose(writer.fp) != 0)
+        ok = false;
+
+    // Written to a temporary file first so a partial file is never loaded.
+    if (ok) {
+        unlink(file_name);
+        ok = rename(temp_file_name, file_name) == 0;
+    }
+    if (!ok) {
+        fprintf(stderr, "Failed to write bytecode cache '%s': %s\n", file_name, strerror(errno));
+        unlink(temp_file_name);
+    }
+}
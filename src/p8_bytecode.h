@@ -0,0 +1,29 @@
+/**
+ * Copyright (C) 2026 Chris January
+ *
+ * Cache of compiled cart scripts. The bytecode for each script is stored
+ * under CACHE_PATH, keyed by a hash of the preprocessed source and its
+ * chunk name, and loaded instead of parsing the source when it matches.
+ */
+
+#ifndef P8_BYTECODE_H
+#define P8_BYTECODE_H
+
+#include <stddef.h>
+#include "lua.h"
+
+/**
+ * Push the cached function for a script.
+ *
+ * @return 0 on a hit, non-zero if there is no usable cache entry, in which
+ *         case nothing is pushed
+ */
+int bytecode_cache_load(lua_State *L, const char *script, size_t length, const char *chunk_name);
+
+/**
+ * Store the function on top of the stack, as compiled from the script, in
+ * the cache. Failures are ignored; the stack is left unchanged.
+ */
+void bytecode_cache_store(lua_State *L, const char *script, size_t length, const char *chunk_name);
+
+#endif /* P8_BYTECODE_H */
@@ -5,111 +5,154 @@
  *      Author: bbaker
  */
 
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <time.h>
-#include "p8_audio.h"
 #include "p8_dsp.h"
 
-int random_range(int min, int max)
+#define WAVETABLE_SHIFT (DSP_CYCLE_BITS - DSP_WAVETABLE_BITS)
+#define WAVETABLE_ONE 32767
+/* Noise picks a new value this many times per cycle (as a power of two). */
+#define NOISE_STEPS_BITS 5
+
+// Single cycles at full scale; the phaser and noise have no table.
+static int16_t wavetables[WAVEFORM_COUNT][DSP_WAVETABLE_SIZE];
+static bool wavetables_built = false;
+
+static inline int wavetable_index(uint32_t phase)
 {
-    return min + ((float)rand() / (float)RAND_MAX) * (max - min);
+    return (phase >> WAVETABLE_SHIFT) & (DSP_WAVETABLE_SIZE - 1);
 }
 
-void dsp_square_wave(uint32_t frequency, int16_t amplitude, int16_t offset, int position, int dest_offset, int dest_length, int16_t *dest)
+// One cycle of each waveform at phase p in [0, 1), in [-1, 1].
+static float waveform_sample(int waveform, float p)
 {
-    int period_length = (float)SAMPLE_RATE / frequency;
-    int half_period = period_length / 2;
-    for (int i = 0; i < dest_length; i++)
+    switch (waveform)
     {
-        int smaple_in_period = position % period_length;
-        dest[dest_offset + i] += (offset + smaple_in_period < half_period ? -amplitude : amplitude);
-        position++;
+    case WAVEFORM_TRIANGLE:
+        return p < 0.5f ? 1.0f - 4.0f * p : 4.0f * p - 3.0f;
+    case WAVEFORM_TILTEDSAW:
+    {
+        const float duty_cycle = 0.85f;
+        if (p < duty_cycle)
+            return -1.0f + 2.0f * (p / duty_cycle);
+        return 1.0f - 2.0f * (p - duty_cycle) / (1.0f - duty_cycle);
+    }
+    case WAVEFORM_SAW:
+        return -1.0f + 2.0f * p;
+    case WAVEFORM_SQUARE:
+        return p < 0.5f ? -1.0f : 1.0f;
+    case WAVEFORM_PULSE:
+        return p < 1.0f / 3.0f ? 1.0f : -1.0f;
+    case WAVEFORM_ORGAN:
+    {
+        const float coefficient = 0.5f;
+        if (p < 0.25f)
+            return 1.0f - 2.0f * (p / 0.25f);
+        else if (p < 0.50f)
+            return -1.0f + (1.0f + coefficient) * (p - 0.25f) / 0.25f;
+        else if (p < 0.75f)
+            return coefficient - (1.0f + coefficient) * (p - 0.50f) / 0.25f;
+        return -1.0f + 2.0f * (p - 0.75f) / 0.25f;
+    }
+    default:
+        return 0.0f;
     }
 }
 
-void dsp_pulse_wave(uint32_t frequency, int16_t amplitude, int16_t offset, float duty_cycle, int position, int dest_offset, int dest_length, int16_t *dest)
+void dsp_init(void)
 {
-    int period_length = (float)SAMPLE_RATE / frequency;
-    int duty_on_length = duty_cycle * period_length;
-    for (int i = 0; i < dest_length; i++)
-    {
-        int smaple_in_period = position % period_length;
-        dest[dest_offset + i] += (offset + smaple_in_period < duty_on_length ? amplitude : -amplitude);
-        position++;
-    }
+    if (wavetables_built)
+        return;
+    for (int w = 0; w < WAVEFORM_COUNT; w++)
+        for (int i = 0; i < DSP_WAVETABLE_SIZE; i++)
+            wavetables[w][i] = (int16_t)(waveform_sample(w, (float)i / DSP_WAVETABLE_SIZE) * WAVETABLE_ONE);
+    wavetables_built = true;
 }
 
-void dsp_triangle_wave(uint32_t frequency, int16_t amplitude, int16_t offset, int position, int dest_offset, int dest_length, int16_t *dest)
+void dsp_osc_init(dsp_osc_t *osc)
 {
-    int period_length = (float)SAMPLE_RATE / frequency;
-    for (int i = 0; i < dest_length; i++)
-    {
-        int repetitions = position / period_length;
-        float p = position / (float)period_length - repetitions;
-        if (p < 0.50f)
-            dest[dest_offset + i] += (offset + amplitude - amplitude * 2 * (p / 0.5f));
-        else
-            dest[dest_offset + i] += (offset - amplitude + amplitude * 2 * ((p - 0.5f) / 0.5f));
-        position++;
-    }
+    osc->phase = 0;
+    osc->lfsr = 0x2545f491;
+    osc->noise = 0;
 }
 
-void dsp_sawtooth_wave(uint32_t frequency, int16_t amplitude, int16_t offset, int position, int dest_offset, int dest_length, int16_t *dest)
+uint32_t dsp_phase_step(float frequency, int sample_rate)
 {
-    int period_length = (float)SAMPLE_RATE / frequency;
-    for (int i = 0; i < dest_length; i++)
+    return (uint32_t)(frequency * (float)(1u << DSP_CYCLE_BITS) / sample_rate + 0.5f);
+}
+
+static void render_wavetable(const int16_t *table, dsp_osc_t *osc, uint32_t step, int16_t amplitude, int length, int16_t *dest)
+{
+    uint32_t phase = osc->phase;
+    for (int i = 0; i < length; i++)
+        dest[i] += (int16_t)((table[wavetable_index(phase + (uint32_t)i * step)] * amplitude) >> 15);
+    osc->phase = phase + (uint32_t)length * step;
+}
+
+// Two triangles, one shifted by up to half a cycle by a triangle LFO that
+// takes 128 cycles (the model zepto8 uses), without its DC offset.
+static void render_phaser(dsp_osc_t *osc, uint32_t step, int16_t amplitude, int length, int16_t *dest)
+{
+    const int16_t *table = wavetables[WAVEFORM_TRIANGLE];
+    uint32_t phase = osc->phase;
+    for (int i = 0; i < length; i++)
     {
-        int repetitions = position / period_length;
-        float p = position / (float)period_length - repetitions;
-        dest[dest_offset + i] += (offset - amplitude + amplitude * 2 * p);
-        position++;
+        uint32_t lfo = phase >> 16;  // position in the 128 cycle period
+        uint32_t shift = lfo < 0x8000 ? 0xffff - 2 * lfo : 2 * lfo - 0x10000;
+        int32_t a = table[wavetable_index(phase + (shift << (DSP_CYCLE_BITS - 17)))];
+        int32_t b = table[wavetable_index(phase)];
+        dest[i] += (int16_t)(((a - 2 * b) / 3 * amplitude) >> 15);
+        phase += step;
     }
+    osc->phase = phase;
 }
 
-void dsp_tilted_sawtooth_wave(uint32_t frequency, int16_t amplitude, int16_t offset, float duty_cycle, int position, int dest_offset, int dest_length, int16_t *dest)
+// Sample and hold a new value from an xorshift LFSR 32 times per cycle, so
+// noise gets brighter with pitch.
+static void render_noise(dsp_osc_t *osc, uint32_t step, int16_t amplitude, int length, int16_t *dest)
 {
-    int period_length = (float)SAMPLE_RATE / frequency;
-    for (int i = 0; i < dest_length; i++)
+    const int shift = DSP_CYCLE_BITS - NOISE_STEPS_BITS;
+    uint32_t phase = osc->phase;
+    uint32_t lfsr = osc->lfsr;
+    int16_t value = osc->noise;
+    int32_t half = amplitude / 2;
+    for (int i = 0; i < length; i++)
     {
-        int repetitions = position / period_length;
-        float p = position / (float)period_length - repetitions;
-        if (p < duty_cycle)
-            dest[dest_offset + i] += (offset - amplitude + amplitude * 2 * (p / duty_cycle));
-        else
+        uint32_t next = phase + step;
+        if ((next >> shift) != (phase >> shift))
         {
-            float op = (p - duty_cycle) / (1.0f - duty_cycle);
-            dest[dest_offset + i] += (offset + amplitude - amplitude * 2 * op);
+            lfsr ^= lfsr << 13;
+            lfsr ^= lfsr >> 17;
+            lfsr ^= lfsr << 5;
+            value = (int16_t)(((int16_t)lfsr * half) >> 15);
         }
-        position++;
+        dest[i] += value;
+        phase = next;
     }
+    osc->phase = phase;
+    osc->lfsr = lfsr;
+    osc->noise = value;
 }
 
-void dsp_organ_wave(uint32_t frequency, int16_t amplitude, int16_t offset, float coefficient, int position, int dest_offset, int dest_length, int16_t *dest)
+void dsp_render(int waveform, dsp_osc_t *osc, uint32_t step, int16_t amplitude, int length, int16_t *dest)
 {
-    int period_length = (float)SAMPLE_RATE / frequency;
-    for (int i = 0; i < dest_length; i++)
+    if (amplitude == 0)
     {
-        int repetitions = position / period_length;
-        float p = position / (float)period_length - repetitions;
-        if (p < 0.25f)
-            dest[dest_offset + i] += (offset + amplitude - amplitude * 2 * (p / 0.25f));
-        else if (p < 0.50f)
-            dest[dest_offset + i] += (offset - amplitude + amplitude * (1.0f + coefficient) * (p - 0.25f) / 0.25f);
-        else if (p < 0.75f)
-            dest[dest_offset + i] += (offset + amplitude * coefficient - amplitude * (1.0f + coefficient) * (p - 0.50f) / 0.25f);
-        else
-            dest[dest_offset + i] += (offset - amplitude + amplitude * 2 * (p - 0.75f) / 0.25f);
-        position++;
+        osc->phase += (uint32_t)length * step;
+        return;
     }
-}
-
-void dsp_noise(uint32_t frequency, int16_t amplitude, int position, int dest_offset, int dest_length, int16_t *dest)
-{
-    for (int i = 0; i < dest_length; i++)
+    switch (waveform)
     {
-        dest[dest_offset + i] += (int16_t)random_range(-amplitude / 2, amplitude / 2);
-        position++;
+    case WAVEFORM_NOISE:
+        render_noise(osc, step, amplitude, length, dest);
+        break;
+    case WAVEFORM_PHASER:
+        render_phaser(osc, step, amplitude, length, dest);
+        break;
+    default:
+        render_wavetable(wavetables[waveform], osc, step, amplitude, length, dest);
+        break;
     }
 }
 
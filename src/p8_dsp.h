@@ -10,14 +10,43 @@
 
 #include <stdint.h>
 
-void dsp_square_wave(uint32_t frequency, int16_t amplitude, int16_t offset, int position, int dest_offset, int dest_length, int16_t *dest);
-void dsp_pulse_wave(uint32_t frequency, int16_t amplitude, int16_t offset, float duty_cycle, int position, int dest_offset, int dest_length, int16_t *dest);
-void dsp_triangle_wave(uint32_t frequency, int16_t amplitude, int16_t offset, int position, int dest_offset, int dest_length, int16_t *dest);
-void dsp_sawtooth_wave(uint32_t frequency, int16_t amplitude, int16_t offset, int position, int dest_offset, int dest_length, int16_t *dest);
-void dsp_tilted_sawtooth_wave(uint32_t frequency, int16_t amplitude, int16_t offset, float duty_cycle, int position, int dest_offset, int dest_length, int16_t *dest);
-void dsp_organ_wave(uint32_t frequency, int16_t amplitude, int16_t offset, float coefficient, int position, int dest_offset, int dest_length, int16_t *dest);
-void dsp_noise(uint32_t frequency, int16_t amplitude, int position, int dest_offset, int dest_length, int16_t *dest);
+enum
+{
+    WAVEFORM_TRIANGLE,
+    WAVEFORM_TILTEDSAW,
+    WAVEFORM_SAW,
+    WAVEFORM_SQUARE,
+    WAVEFORM_PULSE,
+    WAVEFORM_ORGAN,
+    WAVEFORM_NOISE,
+    WAVEFORM_PHASER,
+    WAVEFORM_COUNT
+};
+
+/*
+ * Oscillator phase is a 32-bit accumulator in which one cycle of the
+ * waveform is 2^DSP_CYCLE_BITS; the bits above that count cycles, which the
+ * phaser uses for its slow modulation.
+ */
+#define DSP_CYCLE_BITS 25
+#define DSP_WAVETABLE_BITS 8
+#define DSP_WAVETABLE_SIZE (1 << DSP_WAVETABLE_BITS)
+
+typedef struct
+{
+    uint32_t phase;
+    uint32_t lfsr;
+    int16_t noise;
+} dsp_osc_t;
+
+/* Build the wavetables; call once before rendering. */
+void dsp_init(void);
+void dsp_osc_init(dsp_osc_t *osc);
+/* Phase increment per sample for a frequency in Hz at a sample rate. */
+uint32_t dsp_phase_step(float frequency, int sample_rate);
+/* Add length samples of a waveform at the given amplitude to dest. */
+void dsp_render(int waveform, dsp_osc_t *osc, uint32_t step, int16_t amplitude, int length, int16_t *dest);
 void dsp_fade_in(int16_t amplitude, int dest_offset, int dest_length, int16_t *dest);
 void dsp_fade_out(int16_t amplitude, int dest_offset, int dest_length, int16_t *dest);
 
-#endif
\ No newline at end of file
+#endif
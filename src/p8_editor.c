@@ -3,6 +3,7 @@
 #include <string.h>
 #include <unistd.h>
 
+#include "p8_audio.h"
 #include "p8_cstore.h"
 #include "p8_dialog.h"
 #include "p8_editor.h"
@@ -319,11 +320,29 @@ static void editor_screen_draw(int x, int y, int w, int h)
     overlay_draw_mouse_cursor(m_mouse_x, m_mouse_y);
 }
 
+#ifdef ENABLE_AUDIO
+/* The editors change the cart, but the audio engine plays from RAM: copy
+ * music and SFX edits across so they are heard, even while playing. */
+static void editor_sync_sound_ram(void)
+{
+    const unsigned size = MEMORY_MUSIC_SIZE + MEMORY_SFX_SIZE;
+    if (memcmp(m_memory + MEMORY_MUSIC, m_cart_memory + MEMORY_MUSIC, size) == 0)
+        return;
+    memcpy(m_memory + MEMORY_MUSIC, m_cart_memory + MEMORY_MUSIC, size);
+    memory_mark_written(MEMORY_MUSIC, size);
+    audio_sync_sound_ram();
+}
+#endif
+
 static void editor_screen_update(void)
 {
     if (tab_subeditors[active_tab]->update)
         tab_subeditors[active_tab]->update();
 
+#ifdef ENABLE_AUDIO
+    editor_sync_sound_ram();
+#endif
+
     editor_dialog.cursor_blink++;
 }
 
@@ -91,6 +91,7 @@ static void draw_tile_sprite(int sx, int sy, int sprite_idx)
             int sheet_col = sheet_px + dx;
             uint8_t b = m_cart_memory[MEMORY_SPRITES + (sheet_col >> 1) + sheet_row * 64];
             int col = (sheet_col & 1) ? (b >> 4) : (b & 0xF);
+            overlay_mark_dirty_rows(oy, oy);
             uint8_t *dest = m_overlay_memory + (ox >> 1) + oy * 64;
             if (ox & 1) *dest = (*dest & 0x0F) | ((col & 0xF) << 4);
             else        *dest = (*dest & 0xF0) |  (col & 0xF);
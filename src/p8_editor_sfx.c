@@ -480,6 +480,7 @@ static inline void overlay_put_pixel(int ox, int oy, int col)
 {
     if (ox < overlay_clip_x0 || ox >= overlay_clip_x1) return;
     if (oy < overlay_clip_y0 || oy >= overlay_clip_y1) return;
+    overlay_mark_dirty_rows(oy, oy);
     uint8_t *dest = m_overlay_memory + (ox >> 1) + oy * 64;
     if (ox & 1) *dest = (*dest & 0x0F) | ((col & 0xF) << 4);
     else        *dest = (*dest & 0xF0) |  (col & 0xF);
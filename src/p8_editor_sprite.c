@@ -103,6 +103,7 @@ static inline void put_pixel(int x, int y, int col)
 {
     if (x < overlay_clip_x0 || x >= overlay_clip_x1) return;
     if (y < overlay_clip_y0 || y >= overlay_clip_y1) return;
+    overlay_mark_dirty_rows(y, y);
     uint8_t *dest = m_overlay_memory + (x >> 1) + y * 64;
     if (x & 1) *dest = (*dest & 0x0F) | ((col & 0xF) << 4);
     else        *dest = (*dest & 0xF0) |  (col & 0xF);
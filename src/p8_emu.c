@@ -33,6 +33,8 @@
 #include "p8_overlay_helper.h"
 #include "p8_parser.h"
 #include "p8_pause_menu.h"
+#include "p8_profile.h"
+#include "p8_replay.h"
 
 #if defined(SDL)
 #include "SDL.h"
@@ -43,6 +45,9 @@
 #include "postcodes.h"
 #endif
 
+// Slack left unused by idle-time garbage collection, to absorb overruns.
+#define GC_IDLE_MARGIN_MS 2
+
 #if defined(SDL)
 // ARGB
 uint32_t m_colors[32] = {
@@ -75,6 +80,19 @@ uint8_t *m_decompression_buffer = NULL;
 char    *m_lua_script  = NULL;
 char    *m_temp_lua_script  = NULL;
 
+uint32_t m_screen_dirty_rows[P8_HEIGHT / 32];
+uint32_t m_overlay_dirty_rows[P8_HEIGHT / 32];
+
+sprite_rows_t m_sprite_cache[256];
+uint32_t m_sprite_cache_valid[256 / 32];
+uint8_t m_sprite_cache_palette[16];
+uint8_t m_font_rows[256][8];
+bool m_font_rows_valid = false;
+draw_state_t m_draw_state;
+bool m_draw_state_valid = false;
+uint64_t m_sfx_dirty = ~UINT64_C(0);
+bool m_music_dirty = true;
+
 unsigned m_fps = 30;
 unsigned m_actual_fps = 0;
 unsigned m_frames = 0;
@@ -96,6 +114,7 @@ char m_param_string[256];
 char m_clipboard[1024];
 
 static bool skip_main_loop_if_no_callbacks = false;
+static bool headless = false;
 
 #ifdef SDL
 SDL_Window *m_window = NULL;
@@ -151,6 +170,15 @@ unsigned p8_clock_ms(p8_clock_t clocks)
 #endif
 }
 
+unsigned p8_clock_us(p8_clock_t clocks)
+{
+#if defined(OS_FREERTOS)
+    return clocks * portTICK_PERIOD_MS * 1000;
+#else
+    return clocks;
+#endif
+}
+
 p8_clock_t p8_clock_delta(p8_clock_t start, p8_clock_t end)
 {
     return end - start;
@@ -165,19 +193,9 @@ static void p8_sleep(unsigned ms)
 #endif
 }
 
-int p8_init()
-{
-    assert(!m_initialized);
-
-    srand((unsigned int)time(NULL));
-
 #ifdef SDL
-    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) != 0)
-    {
-        printf("Error on SDL_Init().\n");
-        return 1;
-    }
-
+static int p8_init_window(void)
+{
     SDL_ShowCursor(SDL_DISABLE);
 
     /* Create SDL2 window/renderer/texture and an output surface we render into. */
@@ -219,6 +237,27 @@ int p8_init()
     m_format = m_output->format;
 
     SDL_SetWindowTitle(m_window, "femto-8");
+
+    return 0;
+}
+#endif
+
+int p8_init()
+{
+    assert(!m_initialized);
+
+    srand((unsigned int)time(NULL));
+
+#ifdef SDL
+    // Headless runs still need the event queue for input and quit handling.
+    if (SDL_Init(headless ? SDL_INIT_EVENTS : (SDL_INIT_VIDEO | SDL_INIT_AUDIO)) != 0)
+    {
+        printf("Error on SDL_Init().\n");
+        return 1;
+    }
+
+    if (!headless && p8_init_window() != 0)
+        return 1;
 #endif
 #ifdef OS_FREERTOS
     m_drawSemaphore = xSemaphoreCreateBinary();
@@ -257,6 +296,7 @@ int p8_init()
     }
 
     memset(m_memory, 0, MEMORY_SIZE);
+    draw_state_invalidate();
     memset(m_cart_memory, 0, CART_MEMORY_SIZE);
     memset(m_overlay_memory, (OVERLAY_TRANSPARENT_COLOR << 4) | OVERLAY_TRANSPARENT_COLOR, MEMORY_SCREEN_SIZE);
     m_lua_script[0] = '\0';
@@ -298,6 +338,9 @@ static int p8_init_lcd(void)
 
 void p8_wait_for_any_key(void)
 {
+    if (headless)
+        return;
+
     int x, y;
     cursor_get(&x, &y);
     y = scroll(y, GLYPH_HEIGHT);
@@ -459,6 +502,7 @@ int p8_shutdown()
     lua_shutdown_api();
 
     p8_close_cartdata();
+    profile_close();
 
 #ifdef SDL
     if (m_texture) { SDL_DestroyTexture(m_texture); m_texture = NULL; }
@@ -578,54 +622,152 @@ static uint8_t high_color_resolve(uint8_t hc_mode, uint8_t pix_index, int sx, in
     return color_get(PALTYPE_SCREEN, pix_index);
 }
 
+#define OVERLAY_TRANSPARENT_BYTE ((OVERLAY_TRANSPARENT_COLOR << 4) | OVERLAY_TRANSPARENT_COLOR)
+
+// Screen byte -> two ARGB pixels (low nibble first), rebuilt every frame
+// from the screen palette.
+static uint32_t screen_byte_lut[256][2];
+
+static void build_screen_byte_lut(void)
+{
+    uint32_t colors[16];
+    for (int i = 0; i < 16; i++)
+        colors[i] = m_colors[color_index(color_get(PALTYPE_SCREEN, i))];
+    for (int b = 0; b < 256; b++) {
+        screen_byte_lut[b][0] = colors[b & 0xf];
+        screen_byte_lut[b][1] = colors[b >> 4];
+    }
+}
+
+static bool overlay_row_is_transparent(const uint8_t *row)
+{
+    for (int i = 0; i < P8_WIDTH / 2; i++) {
+        if (row[i] != OVERLAY_TRANSPARENT_BYTE)
+            return false;
+    }
+    return true;
+}
+
+static void render_overlay_row(uint32_t *output, const uint8_t *row)
+{
+    if (overlay_row_is_transparent(row))
+        return;
+
+    for (int x = 0; x < P8_WIDTH; x += 2) {
+        uint8_t value = row[x >> 1];
+        if (value == OVERLAY_TRANSPARENT_BYTE)
+            continue;
+        uint8_t left = value & 0xF;
+        uint8_t right = value >> 4;
+        if (left != OVERLAY_TRANSPARENT_COLOR)
+            output[x] = m_colors[color_index(left)];
+        if (right != OVERLAY_TRANSPARENT_COLOR)
+            output[x + 1] = m_colors[color_index(right)];
+    }
+}
+
+// Registers that affect every output row. Any change since the last
+// frame forces a full redraw.
+typedef struct {
+    uint8_t screen_phys;
+    uint8_t transform;
+    uint8_t hc_mode;
+    uint8_t screen_palette[16];
+    uint8_t secondary_palette[16];
+    uint8_t hc_bitfield[16];
+} display_state_t;
+
+static display_state_t last_display_state;
+static bool last_display_state_valid = false;
+
+static bool display_state_changed(void)
+{
+    display_state_t state;
+    state.screen_phys = m_memory[MEMORY_SCREEN_PHYS];
+    state.transform = m_memory[MEMORY_SCREEN_TRANSFORM];
+    state.hc_mode = m_memory[MEMORY_HIGH_COLOUR_MODE];
+    memcpy(state.screen_palette, &m_memory[MEMORY_PALETTES + PALTYPE_SCREEN * 16], 16);
+    memcpy(state.secondary_palette, &m_memory[MEMORY_PALETTE_SECONDARY], 16);
+    memcpy(state.hc_bitfield, &m_memory[0x5f70], 16);
+    bool changed = !last_display_state_valid || memcmp(&state, &last_display_state, sizeof(state)) != 0;
+    last_display_state = state;
+    last_display_state_valid = true;
+    return changed;
+}
+
+static void upload_rows(int y0, int y1)
+{
+    SDL_Rect rect = {0, y0, P8_WIDTH, y1 - y0};
+    uint32_t *pixels = m_output->pixels;
+    SDL_UpdateTexture(m_texture, &rect, pixels + y0 * P8_WIDTH, m_output->pitch);
+}
+
 void p8_render()
 {
+    if (headless)
+        return;
+
     uint32_t *output = m_output->pixels;
     uint8_t transform = m_memory[MEMORY_SCREEN_TRANSFORM];
     uint8_t hc_mode = m_memory[MEMORY_HIGH_COLOUR_MODE];
+    const uint8_t *screen_mem = &m_memory[m_memory[MEMORY_SCREEN_PHYS] << 8];
 
-    for (int y = 0; y < P8_HEIGHT; y++)
-    {
-        for (int x = 0; x < P8_WIDTH; x++)
-        {
-            int sx, sy;
-            screen_transform_pixel(transform, x, y, &sx, &sy);
-            int screen_offset = (m_memory[MEMORY_SCREEN_PHYS] << 8) + (sx >> 1) + sy * 64;
-            uint8_t value = m_memory[screen_offset];
-            uint8_t pix = IS_EVEN(sx) ? value & 0xF : value >> 4;
-            uint8_t index;
-            if (hc_mode != 0)
-                index = high_color_resolve(hc_mode, pix, sx, sy);
-            else
-                index = color_get(PALTYPE_SCREEN, pix);
-            uint32_t color = m_colors[color_index(index)];
-
-            output[x + (y * P8_WIDTH)] = color;
-        }
-    }
+    // Transformed and high colour output rows depend on other source rows,
+    // so only the plain mode can be updated row by row.
+    if (display_state_changed() || transform != 0 || hc_mode != 0)
+        screen_mark_dirty_rows(0, P8_HEIGHT - 1);
 
-    uint8_t *overlay_mem = m_overlay_memory;
+    if (hc_mode == 0)
+        build_screen_byte_lut();
 
+    int run_start = -1;
     for (int y = 0; y < P8_HEIGHT; y++)
     {
-        for (int x = 0; x < P8_WIDTH; x++)
-        {
-            int overlay_offset = (x >> 1) + y * 64;
-            uint8_t value = overlay_mem[overlay_offset];
-            uint8_t pixel_color = IS_EVEN(x) ? (value & 0xF) : (value >> 4);
+        if (!dirty_rows_test(m_screen_dirty_rows, y) && !dirty_rows_test(m_overlay_dirty_rows, y)) {
+            if (run_start >= 0) {
+                upload_rows(run_start, y);
+                run_start = -1;
+            }
+            continue;
+        }
+        if (run_start < 0)
+            run_start = y;
+
+        uint32_t *out_row = output + y * P8_WIDTH;
 
-            if (pixel_color != OVERLAY_TRANSPARENT_COLOR)
+        if (transform == 0 && hc_mode == 0) {
+            const uint8_t *src = screen_mem + y * (P8_WIDTH / 2);
+            for (int x = 0; x < P8_WIDTH / 2; x++) {
+                const uint32_t *pair = screen_byte_lut[src[x]];
+                out_row[2 * x] = pair[0];
+                out_row[2 * x + 1] = pair[1];
+            }
+        } else {
+            for (int x = 0; x < P8_WIDTH; x++)
             {
-                uint32_t color = m_colors[color_index(pixel_color)];
-                output[x + (y * P8_WIDTH)] = color;
+                int sx, sy;
+                screen_transform_pixel(transform, x, y, &sx, &sy);
+                uint8_t value = screen_mem[(sx >> 1) + sy * 64];
+                if (hc_mode != 0) {
+                    uint8_t pix = IS_EVEN(sx) ? value & 0xF : value >> 4;
+                    out_row[x] = m_colors[color_index(high_color_resolve(hc_mode, pix, sx, sy))];
+                } else {
+                    out_row[x] = screen_byte_lut[value][sx & 1];
+                }
             }
         }
+
+        render_overlay_row(out_row, m_overlay_memory + y * (P8_WIDTH / 2));
     }
+    if (run_start >= 0)
+        upload_rows(run_start, P8_HEIGHT);
+
+    memset(m_screen_dirty_rows, 0, sizeof(m_screen_dirty_rows));
+    memset(m_overlay_dirty_rows, 0, sizeof(m_overlay_dirty_rows));
 
     SDL_Rect rectDest = {0, 0, SCREEN_WIDTH, SCREEN_HEIGHT};
 #ifdef SDL
     if (m_texture && m_renderer) {
-        SDL_UpdateTexture(m_texture, NULL, m_output->pixels, m_output->pitch);
         SDL_RenderClear(m_renderer);
         SDL_RenderCopy(m_renderer, m_texture, NULL, &rectDest);
         SDL_RenderPresent(m_renderer);
@@ -866,8 +1008,24 @@ void p8_render()
     gdi_display_update_async(draw_complete, NULL);
 }
 #elif defined(NEXTP8)
+// Copy the rows of a framebuffer marked in either of the last two frames,
+// since the back buffer was last written two flips ago.
+static void copy_dirty_rows(uint8_t *dest, const uint8_t *src, uint32_t *rows, uint32_t *prev_rows)
+{
+    for (int y = 0; y < P8_HEIGHT; y++) {
+        if (dirty_rows_test(rows, y) || dirty_rows_test(prev_rows, y))
+            memcpy(dest + y * 64, src + y * 64, 64);
+    }
+    memcpy(prev_rows, rows, P8_HEIGHT / 8);
+    memset(rows, 0, P8_HEIGHT / 8);
+}
+
 void p8_render()
 {
+    static uint32_t prev_screen_dirty_rows[P8_HEIGHT / 32];
+    static uint32_t prev_overlay_dirty_rows[P8_HEIGHT / 32];
+    static int last_screen_phys = -1;
+
     while (*(volatile uint8_t *) _VFRONT != vfrontreq) {
         // wait for previous flip to complete
     }
@@ -875,22 +1033,20 @@ void p8_render()
     uint8_t *screen_mem = &m_memory[(m_memory[MEMORY_SCREEN_PHYS] << 8)];
     uint8_t *pal = &m_memory[MEMORY_PALETTES + PALTYPE_SCREEN * 16];
     memcpy((uint8_t *)_PALETTE_BASE, pal, _PALETTE_SIZE);
-    memcpy((uint8_t *)_BACK_BUFFER_BASE, screen_mem, _FRAME_BUFFER_SIZE);
+    if (m_memory[MEMORY_SCREEN_PHYS] != last_screen_phys) {
+        if (last_screen_phys < 0)
+            overlay_mark_dirty_rows(0, P8_HEIGHT - 1);
+        last_screen_phys = m_memory[MEMORY_SCREEN_PHYS];
+        screen_mark_dirty_rows(0, P8_HEIGHT - 1);
+    }
+    copy_dirty_rows((uint8_t *)_BACK_BUFFER_BASE, screen_mem, m_screen_dirty_rows, prev_screen_dirty_rows);
     *(volatile uint8_t *)_HIGH_COLOUR_MODE = m_memory[MEMORY_HIGH_COLOUR_MODE];
     *(volatile uint8_t *)_SCREEN_TRANSFORM = m_memory[MEMORY_SCREEN_TRANSFORM];
     if (m_memory[MEMORY_HIGH_COLOUR_MODE] != 0) {
         uint8_t *secondary_palette = &m_memory[MEMORY_PALETTE_SECONDARY];
         memcpy((uint8_t *)_SECONDARY_PALETTE_BASE, secondary_palette, 32);
     }
-    static int dialog_showing_clear_n = 0;
-    if (m_dialog_showing || dialog_showing_clear_n > 0)
-        memcpy((uint8_t *)_OVERLAY_BACK_BUFFER_BASE, m_overlay_memory, MEMORY_SCREEN_SIZE);
-    else
-        memcpy((uint8_t *)_OVERLAY_BACK_BUFFER_BASE, m_overlay_memory, 512); // optimization: only copy first 8 rows if pause menu not showing
-    if (m_dialog_showing)
-        dialog_showing_clear_n = 2;
-    else if (dialog_showing_clear_n > 0)
-        dialog_showing_clear_n--;
+    copy_dirty_rows((uint8_t *)_OVERLAY_BACK_BUFFER_BASE, m_overlay_memory, m_overlay_dirty_rows, prev_overlay_dirty_rows);
     *(volatile uint8_t *) _VFRONTREQ = vfrontreq = vback;
 }
 #endif
@@ -898,26 +1054,52 @@ void p8_render()
 static void p8_post_flip(void)
 {
     p8_flush_cartdata();
+#ifdef ENABLE_AUDIO
+    audio_sync_sound_ram();
+    audio_render_frame(m_fps);
+#endif
+    bool replay_finished = replay_end_frame();
     p8_update_input();
+    profile_end_frame();
     p8_check_for_pause();
     m_frames++;
+    if (replay_finished)
+        p8_quit();
 }
 
 void p8_flip()
 {
+    p8_clock_t profile_start = profile_begin();
     p8_render();
+    profile_end(PROFILE_RENDER, profile_start);
 
     unsigned elapsed_time = p8_elapsed_time();
-    const unsigned target_frame_time = 1000 / m_fps;
-    int sleep_time = target_frame_time - elapsed_time;
-    if (sleep_time < 0)
-        sleep_time = 0;
-    m_actual_fps = 1000 / (elapsed_time + sleep_time);
-
-    if (sleep_time > 0)
-        p8_sleep(sleep_time);
+    if (replay_is_active()) {
+        // Replays collect every frame, whether or not the frame has time
+        // to spare, so that they use memory the same way on every run.
+        lua_gc_idle(0);
+    }
+    if (headless) {
+        // Run frames back-to-back; report the nominal rate to the cart.
+        m_actual_fps = m_fps;
+    } else {
+        const unsigned target_frame_time = 1000 / m_fps;
+        int sleep_time = target_frame_time - elapsed_time;
+        if (sleep_time < 0)
+            sleep_time = 0;
+        m_actual_fps = 1000 / (elapsed_time + sleep_time);
+
+        if (sleep_time > GC_IDLE_MARGIN_MS && !replay_is_active()) {
+            // Collect garbage in the slack rather than in the next frame.
+            lua_gc_idle((sleep_time - GC_IDLE_MARGIN_MS) * 1000);
+            sleep_time = (int)target_frame_time - (int)p8_elapsed_time();
+        }
+        if (sleep_time > 0)
+            p8_sleep(sleep_time);
+    }
 
     m_start_time = p8_clock();
+    lua_frame_start();
 
     p8_post_flip();
 }
@@ -931,7 +1113,9 @@ static int p8_main_loop()
     {
         const int target_frame_time = 1000 / m_fps;
 
+        p8_clock_t profile_start = profile_begin();
         int ret = lua_update();
+        profile_end(PROFILE_UPDATE, profile_start);
         if (ret != 0)
             return ret;
         updates_since_last_flip++;
@@ -940,8 +1124,12 @@ static int p8_main_loop()
 
         time_debt += elapsed;
 
-        if (time_debt < target_frame_time || updates_since_last_flip >= m_fps) {
+        // Headless runs and replays draw every frame so that they are
+        // deterministic.
+        if (headless || replay_is_active() || time_debt < target_frame_time || updates_since_last_flip >= m_fps) {
+            profile_start = profile_begin();
             ret = lua_draw();
+            profile_end(PROFILE_DRAW, profile_start);
             if (ret != 0)
                 return ret;
             time_debt += p8_elapsed_time() - elapsed;
@@ -964,6 +1152,13 @@ static int p8_main_loop()
     }
 }
 
+time_t p8_time(void)
+{
+    if (replay_is_active())
+        return replay_time();
+    return time(NULL);
+}
+
 unsigned p8_elapsed_time(void)
 {
     p8_clock_t now = p8_clock();
@@ -1033,10 +1228,17 @@ void p8_reset(void)
     pencolor_set(6);
     reset_color();
     clip_set(0, 0, P8_WIDTH, P8_HEIGHT);
-    // time(NULL) is a plain integer; shift left 16 to make it a fix32 integer.
-    p8_seed_rng_state((uint32_t)time(NULL) << 16);
+    uint32_t seed;
+    if (!replay_get_seed(&seed)) {
+        // time is a plain integer; shift left 16 to make it a fix32 integer.
+        seed = (uint32_t)p8_time() << 16;
+    }
+    p8_seed_rng_state(seed);
     m_memory[MEMORY_CURSOR] = cursor_x;
     m_memory[MEMORY_CURSOR + 1] = cursor_y;
+    sprite_cache_invalidate_all();
+    draw_state_invalidate();
+    sound_cache_invalidate_all();
 }
 
 static void p8_common_reset_cart()
@@ -1195,6 +1397,17 @@ bool p8_get_skip_main_loop_if_no_callbacks(void)
     return skip_main_loop_if_no_callbacks;
 }
 
+void p8_set_headless(bool enable)
+{
+    assert(!m_initialized);
+    headless = enable;
+}
+
+bool p8_is_headless(void)
+{
+    return headless;
+}
+
 bool p8_open_cartdata(const char *id)
 {
     if (cartdata)
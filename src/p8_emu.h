@@ -17,6 +17,7 @@
 #include <setjmp.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
 #include <time.h>
 
 #ifdef NEXTP8
@@ -107,6 +108,7 @@
 #define MEMORY_MUSIC_SIZE 0x100
 #define MEMORY_SFX 0x3200
 #define MEMORY_SFX_SIZE 0x1100
+#define MEMORY_SFX_ENTRY_SIZE 68
 #define MEMORY_WORKRAM 0x4300
 #define MEMORY_WORKRAM_SIZE 0x1b00
 #define MEMORY_FONT 0x5600
@@ -286,12 +288,58 @@ extern char m_param_string[256];
 
 extern bool m_load_available;
 
+/* One bit per framebuffer row changed since the last p8_render(). */
+extern uint32_t m_screen_dirty_rows[P8_HEIGHT / 32];
+extern uint32_t m_overlay_dirty_rows[P8_HEIGHT / 32];
+
+/* Sprites decoded through the draw palette: pixel x of each row is held in
+ * bits 4x..4x+3 of pixels[] (the same nibble order as screen memory) and in
+ * bit x of opaque[]. */
+typedef struct {
+    uint32_t pixels[SPRITE_HEIGHT];
+    uint8_t opaque[SPRITE_HEIGHT];
+} sprite_rows_t;
+
+extern sprite_rows_t m_sprite_cache[256];
+extern uint32_t m_sprite_cache_valid[256 / 32];
+extern uint8_t m_sprite_cache_palette[16];
+
+/* The built-in font with one byte per glyph row, bit x set where pixel x is
+ * lit: the layout the custom font at 0x5600 already has in memory. Built on
+ * first use. */
+extern uint8_t m_font_rows[256][8];
+extern bool m_font_rows_valid;
+
+/* Parts of sound RAM written since the audio module last decoded them: one
+ * bit per SFX, and one flag for all the music patterns. */
+extern uint64_t m_sfx_dirty;
+extern bool m_music_dirty;
+
+/* The draw state registers (0x5f00-0x5f3f and 0x5f54-0x5f5f) decoded for
+ * the drawing primitives. Rebuilt on first use after any write to them. */
+typedef struct {
+    int cx, cy;
+    /* Clip rectangle in screen coordinates, clamped to the screen. */
+    int clip_x0, clip_y0, clip_x1, clip_y1;
+    uint16_t fillp;
+    bool fillp_transparent;
+    bool fillp_sprites;
+    bool fillp_graphics_secondary;
+    uint8_t draw_pal[16];
+    uint8_t *screen;
+    uint8_t rw_mask;
+} draw_state_t;
+
+extern draw_state_t m_draw_state;
+extern bool m_draw_state_valid;
+
 void __attribute__ ((noreturn)) p8_abort();
 void p8_check_for_pause(void);
 void p8_clear_reboot_requested(void);
 void p8_clear_quit_requested(void);
 p8_clock_t p8_clock(void);
 unsigned p8_clock_ms(p8_clock_t clocks);
+unsigned p8_clock_us(p8_clock_t clocks);
 p8_clock_t p8_clock_delta(p8_clock_t start, p8_clock_t end);
 void p8_close_cartdata(void);
 void p8_delayed_flush_cartdata(void);
@@ -305,6 +353,7 @@ void p8_flush_cartdata(void);
 bool p8_get_skip_main_loop_if_no_callbacks(void);
 int p8_init(void);
 bool p8_is_cart_running(void);
+bool p8_is_headless(void);
 bool p8_is_quit_requested(void);
 bool p8_is_reboot_requested(void);
 int p8_load(const char *file_name, const char *param, const char *bbs_cart_id, const char *breadcrumb);
@@ -322,12 +371,134 @@ int p8_resolve_relative_path(char *dest_filename, const char *src_filename, size
 void __attribute__ ((noreturn)) p8_restart();
 int p8_run(void);
 void p8_seed_rng_state(uint32_t seed);
+void p8_set_headless(bool enable);
 void p8_set_skip_main_loop_if_no_callbacks(bool skip);
 void p8_show_error_dialog(const char **lines, int line_count, p8_error_severity_t severity);
 void p8_show_io_icon(bool show);
 void p8_show_lua_error_dialog(void);
 void p8_show_version_dialog(void);
 int p8_shutdown(void);
+time_t p8_time(void);
 void p8_wait_for_any_key(void);
 
+static inline void dirty_rows_mark(uint32_t *rows, int y0, int y1)
+{
+    if (y0 < 0)
+        y0 = 0;
+    if (y1 > P8_HEIGHT - 1)
+        y1 = P8_HEIGHT - 1;
+    for (int y = y0; y <= y1; y++)
+        rows[y >> 5] |= 1u << (y & 31);
+}
+
+static inline bool dirty_rows_test(const uint32_t *rows, int y)
+{
+    return (rows[y >> 5] & (1u << (y & 31))) != 0;
+}
+
+// Mark rows y0..y1 of the displayed screen as changed.
+static inline void screen_mark_dirty_rows(int y0, int y1)
+{
+    dirty_rows_mark(m_screen_dirty_rows, y0, y1);
+}
+
+// Mark whatever part of the displayed screen overlaps physical memory
+// [addr, addr + len) as changed.
+static inline void screen_mark_dirty_memory(unsigned addr, unsigned len)
+{
+    unsigned base = m_memory[MEMORY_SCREEN_PHYS] << 8;
+    if (len == 0 || addr + len <= base || addr >= base + MEMORY_SCREEN_SIZE)
+        return;
+    int y0 = addr < base ? 0 : (int)(addr - base) >> 6;
+    int y1 = (int)(addr + len - 1 - base) >> 6;
+    dirty_rows_mark(m_screen_dirty_rows, y0, y1);
+}
+
+static inline void overlay_mark_dirty_rows(int y0, int y1)
+{
+    dirty_rows_mark(m_overlay_dirty_rows, y0, y1);
+}
+
+static inline void sprite_cache_invalidate_all(void)
+{
+    memset(m_sprite_cache_valid, 0, sizeof(m_sprite_cache_valid));
+}
+
+// Drop cached sprites decoded from physical memory [addr, addr + len).
+// Moving the sprite or screen mapping drops everything.
+static inline void sprite_cache_invalidate_memory(unsigned addr, unsigned len)
+{
+    if (len == 0)
+        return;
+    if (addr <= MEMORY_SCREEN_PHYS && addr + len > MEMORY_SPRITE_PHYS) {
+        sprite_cache_invalidate_all();
+        return;
+    }
+    const unsigned sheet_size = MEMORY_SPRITES_SIZE + MEMORY_SPRITES_MAP_SIZE;
+    unsigned base = m_memory[MEMORY_SPRITE_PHYS] << 8;
+    if (addr + len <= base || addr >= base + sheet_size)
+        return;
+    unsigned first = addr < base ? 0 : addr - base;
+    unsigned last = MIN(addr + len - 1 - base, sheet_size - 1);
+    int row0 = first >> 9;
+    int row1 = last >> 9;
+    if (row0 == row1 && (first >> 6) == (last >> 6)) {
+        // A single line of pixels: only the sprites it crosses.
+        for (int col = (first & 63) >> 2; col <= (int)(last & 63) >> 2; col++) {
+            int n = row0 * 16 + col;
+            m_sprite_cache_valid[n >> 5] &= ~(1u << (n & 31));
+        }
+    } else {
+        for (int row = row0; row <= row1; row++)
+            m_sprite_cache_valid[row >> 1] &= (row & 1) ? 0x0000ffff : 0xffff0000;
+    }
+}
+
+static inline void draw_state_invalidate(void)
+{
+    m_draw_state_valid = false;
+}
+
+// Redecode the draw state if physical memory [addr, addr + len) overlaps
+// the draw state registers or the memory mapping.
+static inline void draw_state_invalidate_memory(unsigned addr, unsigned len)
+{
+    if ((addr < MEMORY_DRAWSTATE + MEMORY_DRAWSTATE_SIZE && addr + len > MEMORY_DRAWSTATE) ||
+        (addr <= MEMORY_HIGH_COLOUR_MODE && addr + len > MEMORY_SPRITE_PHYS))
+        draw_state_invalidate();
+}
+
+static inline void sound_cache_invalidate_all(void)
+{
+    m_sfx_dirty = ~UINT64_C(0);
+    m_music_dirty = true;
+}
+
+// Mark the music patterns and SFX stored in physical memory
+// [addr, addr + len) for decoding again.
+static inline void sound_cache_invalidate_memory(unsigned addr, unsigned len)
+{
+    const unsigned end = MEMORY_SFX + MEMORY_SFX_SIZE;
+    if (len == 0 || addr + len <= MEMORY_MUSIC || addr >= end)
+        return;
+    if (addr < MEMORY_SFX)
+        m_music_dirty = true;
+    if (addr + len > MEMORY_SFX) {
+        unsigned first = addr < MEMORY_SFX ? 0 : (addr - MEMORY_SFX) / MEMORY_SFX_ENTRY_SIZE;
+        unsigned last = (MIN(addr + len, end) - 1 - MEMORY_SFX) / MEMORY_SFX_ENTRY_SIZE;
+        for (unsigned sfx = first; sfx <= last; sfx++)
+            m_sfx_dirty |= UINT64_C(1) << sfx;
+    }
+}
+
+// Record a write to physical memory [addr, addr + len) made outside the
+// drawing primitives.
+static inline void memory_mark_written(unsigned addr, unsigned len)
+{
+    screen_mark_dirty_memory(addr, len);
+    sprite_cache_invalidate_memory(addr, len);
+    draw_state_invalidate_memory(addr, len);
+    sound_cache_invalidate_memory(addr, len);
+}
+
 #endif
@@ -6,6 +6,7 @@
 
 #include "p8_emu.h"
 #include "p8_input.h"
+#include "p8_replay.h"
 
 #if defined(SDL)
 #include "SDL.h"
@@ -965,25 +966,39 @@ void p8_update_input()
         queue_mouse_click(new_buttons, m_mouse_x, m_mouse_y, m_mouse_keymod);
 #endif
 
+    const bool replayed = replay_apply_input(m_buttons, PLAYER_COUNT);
+    if (replayed) {
+        for (unsigned p=0;p<PLAYER_COUNT;++p) {
+            m_memory[MEMORY_BUTTON_STATE + p] = m_buttons[p] & 0xff;
+#ifdef SDL
+            m_buttons_latch[p] = 0;
+#endif
+        }
+    }
+
     uint8_t delay = m_memory[MEMORY_AUTO_REPEAT_DELAY];
     if (delay == 0)
         delay = DEFAULT_AUTO_REPEAT_DELAY;
     uint8_t interval = m_memory[MEMORY_AUTO_REPEAT_INTERVAL];
     if (interval == 0)
         interval = DEFAULT_AUTO_REPEAT_INTERVAL;
-    for (unsigned p=0;p<PLAYER_COUNT;++p) {
-#ifndef NEXTP8
-        m_buttonsp[p] = 0;
+#ifdef NEXTP8
+    // The hardware latches give btnp, except for replayed input
+    const bool derive_pressed = replayed;
+#else
+    const bool derive_pressed = true;
 #endif
+    for (unsigned p=0;p<PLAYER_COUNT;++p) {
+        if (derive_pressed)
+            m_buttonsp[p] = 0;
         for (unsigned i=0;i<BUTTON_INTERNAL_COUNT;++i) {
             if (m_buttons[p] & (1 << i)) {
                 if (m_button_down_time[p][i] == UINT_MAX) {
                     // ignore buttons pressed at startup
                 } else if (!m_button_down_time[p][i]) {
                     m_button_down_time[p][i] = m_frames;
-#ifndef NEXTP8
-                    m_buttonsp[p] |= 1 << i;
-#endif
+                    if (derive_pressed)
+                        m_buttonsp[p] |= 1 << i;
                 } else if (i < BUTTON_REPEAT_COUNT) {
                     if (delay != 255 && !(m_button_first_repeat[p] & (1 << i)) && m_frames - m_button_down_time[p][i] >= delay) {
                         m_button_down_time[p][i] = m_frames;
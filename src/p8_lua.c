@@ -9,12 +9,20 @@
 #include <assert.h>
 #include "p8_symbols.h"
 #include "pico_font.h"
+#include "p8_alloc.h"
 #include "p8_audio.h"
 #include "p8_browse.h"
+#include "p8_bytecode.h"
 #include "p8_emu.h"
 #include "p8_input.h"
 #include "p8_lua.h"
 #include "p8_repl.h"
+#include "p8_replay.h"
+
+#define GC_IDLE_HEADROOM (64 * 1024)
+#define GC_IDLE_LOOKAHEAD_FRAMES 4
+#define GC_REPLAY_STEP_KB 64
+#define GC_REPLAY_STRING_SEED 0x2d1a6f35u
 #if defined(_WIN32)
 #include <windows.h>
 #include <psapi.h>    // GetProcessMemoryInfo
@@ -50,6 +58,7 @@
 #include "p8_parser.h"
 #include "p8_cstore.h"
 #include "p8_pause_menu.h"
+#include "p8_profile.h"
 #include "lua_api.h"
 #include "lua.h"
 #include "lualib.h"
@@ -68,6 +77,11 @@ const void *m_lua_draw = NULL;
 
 static int m_tline_precision = 13;
 
+// Function calls made since the frame started. While a replay is active
+// the CPU stats count each one as 1/65536 of a frame instead of measuring
+// wall-clock time, so that they are the same on every run.
+static unsigned m_replay_calls = 0;
+
 static int m_load_result = 0;  /* stat(107): 1=success, -1=not found, -2=fetch failed, -3=no bbs */
 
 int lua_load_api();
@@ -265,6 +279,7 @@ int fillp(lua_State *L)
         m_memory[MEMORY_FILLP_ATTR] = ((n & 0x8000) ? 1 : 0) | ((n & 0x4000) ? 2 : 0) | ((n & 0x2000) ? 4: 0);
 
     }
+    draw_state_invalidate();
     return 0;
 }
 
@@ -677,17 +692,26 @@ int rrectfill(lua_State *L)
     if (!invert && is_bbox_offscreen(left, top, right, bottom)) return 0;
 
     if (invert) {
-        int cx, cy;
-        camera_get(&cx, &cy);
-        int clip_x0, clip_y0, clip_x1, clip_y1;
-        clip_get(&clip_x0, &clip_y0, &clip_x1, &clip_y1);
-        for (int y = clip_y0; y < clip_y1; y++) {
-            for (int x = clip_x0; x < clip_x1; x++) {
-                int wx = x + cx;
-                int wy = y + cy;
-                if (!point_in_round_rect(wx, wy, left, top, right, bottom, r))
-                    pixel_set(wx, wy, col, fillp, DRAWTYPE_GRAPHIC);
+        // Fill the clip region outside the rounded rectangle.
+        span_fill_t f;
+        span_fill_init(&f, col, fillp);
+        int clip_left = f.clip_x0 + f.cx;
+        int clip_right = f.clip_x1 - 1 + f.cx;
+        for (int y = MAX(f.clip_y0, 0) + f.cy; y < f.clip_y1 + f.cy; y++) {
+            if (y < top || y > bottom) {
+                span_fill_row(&f, clip_left, clip_right, y);
+                continue;
             }
+            int inside_left = left;
+            int inside_right = right;
+            if (r > 0 && (y < top + r || y > bottom - r)) {
+                int dy = y < top + r ? y - (top + r) : y - (bottom - r);
+                int half_width = oval_half_width(r, r, dy);
+                inside_left = left + r - half_width;
+                inside_right = right - r + half_width;
+            }
+            span_fill_row(&f, clip_left, inside_left - 1, y);
+            span_fill_row(&f, inside_right + 1, clip_right, y);
         }
         return 0;
     }
@@ -802,6 +826,119 @@ int sspr(lua_State *L)
     return 0;
 }
 
+// Map and sprite state for tline(), resolved once per call. The texel
+// lookup remembers the last map cell so that consecutive texels within a
+// tile only index the sprite sheet.
+typedef struct {
+    bool map_invalid;
+    uint8_t map_start_upper;
+    uint8_t map_start_lower;
+    int map_width;
+    int sprite_base;
+    int layer;
+    bool sprite_0_opaque;
+    const uint8_t *draw_pal;
+    const uint8_t *sprite_flags;
+    int cell_x, cell_y;
+    bool cell_drawn;
+    int tile_offset;
+} tline_texture_t;
+
+static void tline_texture_init(tline_texture_t *t, int layer)
+{
+    uint8_t map_start = m_memory[MEMORY_MAP_START];
+    t->map_invalid = (map_start >= 0x10 && map_start < 0x20) ||
+                     (map_start >= 0x30 && map_start < 0x3f);
+    t->map_start_upper = map_start;
+    t->map_start_lower = map_start;
+    if (!t->map_invalid) {
+        if (map_start < 0x10 || (map_start >= 0x40 && map_start < 0x80))
+            t->map_start_upper = 0x20;
+        else
+            t->map_start_upper = map_start;
+        t->map_start_lower = (t->map_start_upper < 0x80) ? 0x10 : t->map_start_upper;
+    }
+    t->map_width = m_memory[MEMORY_MAP_WIDTH];
+    if (t->map_width == 0) t->map_width = 256;
+
+    t->sprite_base = m_memory[MEMORY_SPRITE_PHYS] << 8;
+    t->layer = layer;
+    t->sprite_0_opaque = (m_memory[MEMORY_MISCFLAGS] & 0x8) != 0;
+    t->draw_pal = &m_memory[MEMORY_PALETTES + PALTYPE_DRAW * 16];
+    t->sprite_flags = &m_memory[MEMORY_SPRITEFLAGS];
+    // No cell is loaded: the first texel lookup loads one.
+    t->cell_x = INT_MIN;
+    t->cell_y = INT_MIN;
+    t->cell_drawn = false;
+    t->tile_offset = 0;
+}
+
+static void tline_texture_load_cell(tline_texture_t *t, int cell_x, int cell_y, int offset_x, int offset_y)
+{
+    int index = 0;
+    // Bounds check uses pre-offset coordinates (PICO-8 behaviour: offset doesn't
+    // make a negative texture coordinate valid for map lookup).
+    if (!t->map_invalid && cell_x >= 0 && cell_y >= 0) {
+        int celx = cell_x + offset_x;
+        int cely = cell_y + offset_y;
+        uint8_t ms = (cely >= 32 && t->map_start_upper < 0x80) ? t->map_start_lower : t->map_start_upper;
+        int adj_cely = (cely >= 32 && t->map_start_upper < 0x80) ? cely - 32 : cely;
+        int address = (ms << 8) + celx + adj_cely * t->map_width;
+        if (address >= 0x1000 && address < 0x10000 &&
+            !(address >= 0x3000 && address < 0x8000))
+            index = m_memory[address];
+    }
+    t->cell_x = cell_x;
+    t->cell_y = cell_y;
+    t->cell_drawn = (index != 0 || t->sprite_0_opaque) &&
+                    (t->layer == 0 || ((t->layer & t->sprite_flags[index]) == t->layer));
+    t->tile_offset = t->sprite_base + (index & 0xF) * 4 + (index >> 4) * 8 * 64;
+}
+
+// Colour of texel (tx, ty), in pre-offset pixel coordinates, or -1 if it
+// is not drawn.
+static inline int tline_texel(tline_texture_t *t, int tx, int ty, int offset_x, int offset_y)
+{
+    if ((tx >> 3) != t->cell_x || (ty >> 3) != t->cell_y)
+        tline_texture_load_cell(t, tx >> 3, ty >> 3, offset_x, offset_y);
+    if (!t->cell_drawn)
+        return -1;
+    uint8_t b = m_memory[t->tile_offset + ((tx & 7) >> 1) + (ty & 7) * 64];
+    uint8_t mapped = t->draw_pal[(tx & 1) ? b >> 4 : b & 0xF];
+    return (mapped & 0xf0) == 0 ? mapped : -1;
+}
+
+static inline void tline_pixel_set(uint8_t *p, bool odd, uint8_t col, bool use_rw_mask, uint8_t rw_mask)
+{
+    if (use_rw_mask) {
+        uint8_t write_mask = rw_mask & 0xf;
+        uint8_t read_mask = (rw_mask >> 4) & 0xf;
+        uint8_t dst = odd ? *p >> 4 : *p & 0xf;
+        col = (dst & ~write_mask) | (col & write_mask & read_mask);
+    }
+    *p = odd ? (col << 4) | (*p & 0xF) : (*p & 0xF0) | (col & 0xF);
+}
+
+// Draw count pixels of a horizontal or vertical tline, already clipped,
+// starting at screen position (px, py) and texture position (mx, my).
+static inline void tline_span(tline_texture_t *t, uint8_t *screen, int px, int py, int step_x, int step_y, int count,
+                              uint32_t mx_bits, uint32_t my_bits, uint32_t mdx_bits, uint32_t mdy_bits,
+                              uint32_t mask_x_bits, uint32_t mask_y_bits, int precision, int offset_x, int offset_y,
+                              bool use_rw_mask, uint8_t rw_mask)
+{
+    for (int i = 0; i < count; i++) {
+        int tx = ((int32_t)(mx_bits & mask_x_bits)) >> precision;
+        int ty = ((int32_t)(my_bits & mask_y_bits)) >> precision;
+        int col = tline_texel(t, tx, ty, offset_x, offset_y);
+        if (col >= 0)
+            tline_pixel_set(screen + (px >> 1) + py * 64, !IS_EVEN(px), col, use_rw_mask, rw_mask);
+        px += step_x;
+        py += step_y;
+        mx_bits += mdx_bits;
+        my_bits += mdy_bits;
+    }
+}
+
 // tline( x0, y0, x1, y1, mx, my, [mdx,] [mdy])
 // tline( precision )
 int tline(lua_State *L)
@@ -825,27 +962,15 @@ int tline(lua_State *L)
     camera_get(&cx, &cy);
     int clip_x0, clip_y0, clip_x1, clip_y1;
     clip_get(&clip_x0, &clip_y0, &clip_x1, &clip_y1);
+    clip_x1 = MIN(clip_x1, P8_WIDTH);
+    clip_y1 = MIN(clip_y1, P8_HEIGHT);
 
-    uint8_t map_start = m_memory[MEMORY_MAP_START];
-    bool map_invalid = (map_start >= 0x10 && map_start < 0x20) ||
-                       (map_start >= 0x30 && map_start < 0x3f);
-    uint8_t map_start_upper = map_start;
-    uint8_t map_start_lower = map_start;
-    if (!map_invalid) {
-        if (map_start < 0x10 || (map_start >= 0x40 && map_start < 0x80))
-            map_start_upper = 0x20;
-        else
-            map_start_upper = map_start;
-        map_start_lower = (map_start_upper < 0x80) ? 0x10 : map_start_upper;
-    }
-    int map_width = m_memory[MEMORY_MAP_WIDTH];
-    if (map_width == 0) map_width = 256;
-
-    int sprite_base = m_memory[MEMORY_SPRITE_PHYS] << 8;
-    int screen_base = m_memory[MEMORY_SCREEN_PHYS] << 8;
+    tline_texture_t t;
+    tline_texture_init(&t, layer);
+    uint8_t *screen = m_memory + (m_memory[MEMORY_SCREEN_PHYS] << 8);
 
-    int offset_x = m_memory[MEMORY_TLINE_OFFSET_X] * 8;
-    int offset_y = m_memory[MEMORY_TLINE_OFFSET_Y] * 8;
+    int offset_x = m_memory[MEMORY_TLINE_OFFSET_X];
+    int offset_y = m_memory[MEMORY_TLINE_OFFSET_Y];
     int precision = m_tline_precision;
 
     uint32_t mask_x_bits = ((uint32_t)m_memory[MEMORY_TLINE_MASK_X] << (precision + 3)) - 1;
@@ -856,68 +981,71 @@ int tline(lua_State *L)
     uint32_t mdx_bits = fix32_bits(mdx);
     uint32_t mdy_bits = fix32_bits(mdy);
 
+    uint8_t rw_mask = m_memory[MEMORY_RW_MASK];
+
+    if (x0 == x1 || y0 == y1) {
+        // Horizontal or vertical: clip the span once, then step the screen
+        // and texture positions together.
+        bool horizontal = y0 == y1;
+        int step = horizontal ? (x0 < x1 ? 1 : -1) : (y0 < y1 ? 1 : -1);
+        int count = (horizontal ? abs(x1 - x0) : abs(y1 - y0)) + 1;
+        int px = x0 - cx;
+        int py = y0 - cy;
+        int pos = horizontal ? px : py;
+        int lo = horizontal ? MAX(clip_x0, 0) : MAX(clip_y0, 0);
+        int hi = (horizontal ? clip_x1 : clip_y1) - 1;
+        int fixed = horizontal ? py : px;
+        int fixed_lo = horizontal ? MAX(clip_y0, 0) : MAX(clip_x0, 0);
+        int fixed_hi = horizontal ? clip_y1 : clip_x1;
+        if (fixed < fixed_lo || fixed >= fixed_hi)
+            return 0;
+
+        // Pixels i in [first, last] have pos + i * step within [lo, hi].
+        int first = step > 0 ? lo - pos : pos - hi;
+        int last = step > 0 ? hi - pos : pos - lo;
+        first = MAX(first, 0);
+        last = MIN(last, count - 1);
+        if (first > last)
+            return 0;
+
+        pos += first * step;
+        if (horizontal) {
+            px = pos;
+            screen_mark_dirty_rows(py, py);
+        } else {
+            py = pos;
+            screen_mark_dirty_rows(MIN(py, py + (last - first) * step), MAX(py, py + (last - first) * step));
+        }
+        mx_bits += (uint32_t)first * mdx_bits;
+        my_bits += (uint32_t)first * mdy_bits;
+        int step_x = horizontal ? step : 0;
+        int step_y = horizontal ? 0 : step;
+        if (rw_mask != 0xff)
+            tline_span(&t, screen, px, py, step_x, step_y, last - first + 1, mx_bits, my_bits, mdx_bits, mdy_bits,
+                       mask_x_bits, mask_y_bits, precision, offset_x, offset_y, true, rw_mask);
+        else
+            tline_span(&t, screen, px, py, step_x, step_y, last - first + 1, mx_bits, my_bits, mdx_bits, mdy_bits,
+                       mask_x_bits, mask_y_bits, precision, offset_x, offset_y, false, rw_mask);
+        return 0;
+    }
+
     int dx = abs(x1 - x0);
     int sx = x0 < x1 ? 1 : -1;
     int dy = -abs(y1 - y0);
     int sy = y0 < y1 ? 1 : -1;
     int err = dx + dy;
 
-    uint8_t *draw_pal = &m_memory[MEMORY_PALETTES + PALTYPE_DRAW * 16];
-    uint8_t *sprite_flags_base = &m_memory[MEMORY_SPRITEFLAGS];
-    bool sprite_0_opaque = (m_memory[MEMORY_MISCFLAGS] & 0x8) != 0;
-    uint8_t rw_mask = m_memory[MEMORY_RW_MASK];
-
     while (true)
     {
-        uint32_t tmx = mx_bits & mask_x_bits;
-        uint32_t tmy = my_bits & mask_y_bits;
-
-        int tx_raw = ((int32_t)tmx) >> precision;
-        int ty_raw = ((int32_t)tmy) >> precision;
-        int tx = tx_raw + offset_x;
-        int ty = ty_raw + offset_y;
-
-        int celx = tx >> 3;
-        int cely = ty >> 3;
-        int index = 0;
-        // Bounds check uses pre-offset coordinates (PICO-8 behaviour: offset doesn't
-        // make a negative texture coordinate valid for map lookup).
-        if (!map_invalid && (tx_raw >> 3) >= 0 && (ty_raw >> 3) >= 0) {
-            uint8_t ms = (cely >= 32 && map_start_upper < 0x80) ? map_start_lower : map_start_upper;
-            int adj_cely = (cely >= 32 && map_start_upper < 0x80) ? cely - 32 : cely;
-            int address = (ms << 8) + celx + adj_cely * map_width;
-            if (address >= 0x1000 && address < 0x10000 &&
-                !(address >= 0x3000 && address < 0x8000))
-                index = m_memory[address];
-        }
-        if ((index != 0 || sprite_0_opaque) && (layer == 0 || ((layer & sprite_flags_base[index]) == layer))) {
-            int spx = (index & 0xF) * 8 + (tx & 7);
-            int spy = (index >> 4) * 8 + (ty & 7);
-
-            int spr_offset = sprite_base + (spx >> 1) + spy * 64;
-            uint8_t col = IS_EVEN(spx) ? m_memory[spr_offset] & 0xF : m_memory[spr_offset] >> 4;
-
-            uint8_t mapped = draw_pal[col & 0xf];
-            int px = x0 - cx;
-            int py = y0 - cy;
-            if ((mapped & 0xf0) == 0) {
-                if (px >= clip_x0 && px < clip_x1 && py >= clip_y0 && py < clip_y1) {
-                    int scr_offset = screen_base + (px >> 1) + py * 64;
-                    if (rw_mask != 0xff) {
-                        uint8_t write_mask = rw_mask & 0xf;
-                        uint8_t read_mask = (rw_mask >> 4) & 0xf;
-                        uint8_t dst = IS_EVEN(px) ? m_memory[scr_offset] & 0xf : m_memory[scr_offset] >> 4;
-                        uint8_t src = mapped & 0xf;
-                        uint8_t result = (dst & ~write_mask) | (src & write_mask & read_mask);
-                        m_memory[scr_offset] = IS_EVEN(px)
-                            ? (m_memory[scr_offset] & 0xF0) | result
-                            : (result << 4) | (m_memory[scr_offset] & 0xF);
-                    } else {
-                        m_memory[scr_offset] = IS_EVEN(px)
-                            ? (m_memory[scr_offset] & 0xF0) | (mapped & 0xF)
-                            : (mapped << 4) | (m_memory[scr_offset] & 0xF);
-                    }
-                }
+        int px = x0 - cx;
+        int py = y0 - cy;
+        if (px >= MAX(clip_x0, 0) && px < clip_x1 && py >= MAX(clip_y0, 0) && py < clip_y1) {
+            int tx = ((int32_t)(mx_bits & mask_x_bits)) >> precision;
+            int ty = ((int32_t)(my_bits & mask_y_bits)) >> precision;
+            int col = tline_texel(&t, tx, ty, offset_x, offset_y);
+            if (col >= 0) {
+                screen_mark_dirty_rows(py, py);
+                tline_pixel_set(screen + (px >> 1) + py * 64, !IS_EVEN(px), col, rw_mask != 0xff, rw_mask);
             }
         }
 
@@ -949,11 +1077,211 @@ int tline(lua_State *L)
 // *** Tables ***
 // ****************************************************************
 
-// add(tbl, v)
+// Push t[key] for the table at index t, honouring metamethods.
+static void table_get(lua_State *L, int t, lua_Number key)
+{
+    lua_pushnumber(L, key);
+    lua_gettable(L, t);
+}
+
+// Pop a value into t[key], honouring metamethods.
+static void table_set(lua_State *L, int t, lua_Number key)
+{
+    lua_pushnumber(L, key);
+    lua_insert(L, -2);
+    lua_settable(L, t);
+}
+
+// #t, honouring __len.
+static lua_Number table_len(lua_State *L, int t)
+{
+    lua_len(L, t);
+    lua_Number len = lua_tonumber(L, -1);
+    lua_pop(L, 1);
+    return len;
+}
+
+// add(tbl, v, [index])
+int add(lua_State *L)
+{
+    if (lua_type(L, 1) != LUA_TTABLE)
+        return 0;
+    lua_settop(L, 3);
+    lua_Number len = table_len(L, 1);
+    if (lua_isnil(L, 3)) {
+        lua_pushvalue(L, 2);
+        table_set(L, 1, fix32_add(len, FIX32_ONE));
+    } else {
+        lua_Number i = luaL_checknumber(L, 3);
+        for (lua_Number j = len; j >= i; j = fix32_sub(j, FIX32_ONE)) {
+            table_get(L, 1, j);
+            table_set(L, 1, fix32_add(j, FIX32_ONE));
+        }
+        lua_pushvalue(L, 2);
+        table_set(L, 1, i);
+    }
+    lua_pushvalue(L, 2);
+    return 1;
+}
+
+static int all_none(lua_State *L)
+{
+    return 0;
+}
+
+// Upvalues: the string and the index of the last character returned.
+static int all_string_next(lua_State *L)
+{
+    size_t len;
+    const char *str = lua_tolstring(L, lua_upvalueindex(1), &len);
+    int i = lua_tointeger(L, lua_upvalueindex(2));
+    if ((size_t)i >= len)
+        return 0;
+    lua_pushinteger(L, i + 1);
+    lua_replace(L, lua_upvalueindex(2));
+    lua_pushlstring(L, str + i, 1);
+    return 1;
+}
+
+// Upvalues: the table, the current index and the value last returned. If
+// the entry at the current index still holds that value the iterator moves
+// on, otherwise (it was deleted) the entry that moved down into its place
+// is returned next. Holes below #t are skipped.
+static int all_table_next(lua_State *L)
+{
+    int t = lua_upvalueindex(1);
+    lua_Number i = lua_tonumber(L, lua_upvalueindex(2));
+    table_get(L, t, i);
+    if (lua_compare(L, -1, lua_upvalueindex(3), LUA_OPEQ))
+        i = fix32_add(i, FIX32_ONE);
+    lua_pop(L, 1);
+
+    lua_Number len = table_len(L, t);
+    table_get(L, t, i);
+    while (i <= len && lua_isnil(L, -1)) {
+        lua_pop(L, 1);
+        i = fix32_add(i, FIX32_ONE);
+        table_get(L, t, i);
+    }
+    lua_pushvalue(L, -1);
+    lua_replace(L, lua_upvalueindex(3));
+    lua_pushnumber(L, i);
+    lua_replace(L, lua_upvalueindex(2));
+    return 1;
+}
+
+static void push_all_iterator(lua_State *L, int idx)
+{
+    if (lua_isnoneornil(L, idx)) {
+        lua_pushcfunction(L, all_none);
+    } else if (lua_type(L, idx) == LUA_TSTRING) {
+        lua_pushvalue(L, idx);
+        lua_pushinteger(L, 0);
+        lua_pushcclosure(L, all_string_next, 2);
+    } else {
+        lua_pushvalue(L, idx);
+        lua_pushnumber(L, 0);
+        lua_pushnil(L);
+        lua_pushcclosure(L, all_table_next, 3);
+    }
+}
+
 // all(tbl)
-// count(tbl)
+int all(lua_State *L)
+{
+    push_all_iterator(L, 1);
+    return 1;
+}
+
+// count(tbl, [v])
+int count(lua_State *L)
+{
+    if (lua_type(L, 1) != LUA_TTABLE) {
+        lua_pushnil(L);
+        return 1;
+    }
+    if (lua_isnoneornil(L, 2)) {
+        lua_len(L, 1);
+        return 1;
+    }
+    lua_Number len = table_len(L, 1);
+    int c = 0;
+    for (lua_Number i = FIX32_ONE; i <= len; i = fix32_add(i, FIX32_ONE)) {
+        table_get(L, 1, i);
+        if (lua_compare(L, -1, 2, LUA_OPEQ))
+            c++;
+        lua_pop(L, 1);
+    }
+    lua_pushinteger(L, c);
+    return 1;
+}
+
 // del(tbl, v)
+int del(lua_State *L)
+{
+    if (lua_type(L, 1) != LUA_TTABLE)
+        return 0;
+    lua_settop(L, 2);
+    lua_Number len = table_len(L, 1);
+    bool found = false;
+    for (lua_Number i = FIX32_ONE; i <= len; i = fix32_add(i, FIX32_ONE)) {
+        if (!found) {
+            table_get(L, 1, i);
+            found = lua_compare(L, -1, 2, LUA_OPEQ);
+            lua_pop(L, 1);
+        }
+        if (found) {
+            table_get(L, 1, fix32_add(i, FIX32_ONE));
+            table_set(L, 1, i);
+        }
+    }
+    return found ? 1 : 0;
+}
+
+// deli(tbl, [i])
+int deli(lua_State *L)
+{
+    if (lua_type(L, 1) != LUA_TTABLE)
+        return 0;
+    lua_settop(L, 2);
+    lua_Number len = table_len(L, 1);
+    lua_Number i = lua_isnil(L, 2) ? len : luaL_checknumber(L, 2);
+    if (i < FIX32_ONE || i > len) {
+        lua_pushnil(L);
+        return 1;
+    }
+    table_get(L, 1, i);
+    for (lua_Number j = i; j <= len; j = fix32_add(j, FIX32_ONE)) {
+        table_get(L, 1, fix32_add(j, FIX32_ONE));
+        table_set(L, 1, j);
+    }
+    return 1;
+}
+
+// Stack: tbl, func, iterator. Also the continuation when func yields.
+static int foreach_next(lua_State *L)
+{
+    for (;;) {
+        lua_pushvalue(L, 3);
+        lua_call(L, 0, 1);
+        if (lua_isnil(L, -1))
+            return 0;
+        lua_pushvalue(L, 2);
+        lua_insert(L, -2);
+        lua_callk(L, 1, 0, 0, foreach_next);
+    }
+}
+
 // foreach(tbl, func)
+int foreach(lua_State *L)
+{
+    if (lua_isnoneornil(L, 1))
+        return 0;
+    lua_settop(L, 2);
+    push_all_iterator(L, 1);
+    return foreach_next(L);
+}
+
 // pairs(tbl)
 
 // ****************************************************************
@@ -1095,19 +1423,44 @@ int map(lua_State *L)
     int start_x, start_y, end_x, end_y;
     map_get_visible_cells(sx, sy, celw, celh, &start_x, &start_y, &end_x, &end_y);
 
+    bool sprite_0_opaque = (m_memory[MEMORY_MISCFLAGS] & 0x8) != 0;
+    bool should_draw[256];
+    for (int index = 0; index < 256; index++) {
+        uint8_t sprite_flags = m_memory[MEMORY_SPRITEFLAGS + index];
+        should_draw[index] = (index != 0 || sprite_0_opaque) && (layer == 0 || ((layer & sprite_flags) == layer));
+    }
+
+    sprite_blit_t b;
+    bool blit = sprite_blit_init(&b);
+
     for (int y = start_y; y < end_y; y++)
     {
+        int row_base = map_row_base(cely + y);
+        int top = sy + y * SPRITE_HEIGHT;
+        int y0 = 0, y1 = SPRITE_HEIGHT;
+        if (blit) {
+            top -= b.cy;
+            y0 = MAX(MAX(b.clip_y0, 0), top) - top;
+            y1 = MIN(b.clip_y1, top + SPRITE_HEIGHT) - top;
+            if (y0 >= y1)
+                continue;
+        }
+
         for (int x = start_x; x < end_x; x++)
         {
-            uint8_t index = map_get(celx + x, cely + y);
-            uint8_t sprite_flags = m_memory[MEMORY_SPRITEFLAGS + index];
-            bool sprite_0_opaque = (m_memory[MEMORY_MISCFLAGS] & 0x8) != 0;
-            bool should_draw = (index != 0 || sprite_0_opaque) && (layer == 0 || ((layer & sprite_flags) == layer));
-
-            if (should_draw)
-            {
-                int left = sx + x * SPRITE_WIDTH;
-                int top = sy + y * SPRITE_HEIGHT;
+            int address = map_row_cell_addr(row_base, celx + x);
+            uint8_t index = address ? m_memory[address] : 0;
+            if (!should_draw[index])
+                continue;
+
+            int left = sx + x * SPRITE_WIDTH;
+            if (blit) {
+                left -= b.cx;
+                int x0 = MAX(MAX(b.clip_x0, 0), left) - left;
+                int x1 = MIN(b.clip_x1, left + SPRITE_WIDTH) - left;
+                if (x0 < x1)
+                    sprite_blit_clipped(&b, index, left, top, x0, x1, y0, y1, false, false);
+            } else {
                 draw_sprite(index, left, top, false, false);
             }
         }
@@ -1262,6 +1615,7 @@ int _memcpy(lua_State *L)
         unsigned destaddr1 = addr_remap(destaddr);
         unsigned sourceaddr1 = addr_remap(sourceaddr);
         memmove(m_memory + destaddr1, m_memory + sourceaddr1, chunk);
+        memory_mark_written(destaddr1, chunk);
         destaddr += chunk;
         sourceaddr += chunk;
         len -= chunk;
@@ -1282,6 +1636,7 @@ int _memset(lua_State *L)
         unsigned chunk = MIN(len, 0x2000 - (destaddr & 0x1fff));
         unsigned destaddr1 = addr_remap(destaddr);
         memset(m_memory + destaddr1, val, chunk);
+        memory_mark_written(destaddr1, chunk);
         destaddr += chunk;
         len -= chunk;
     }
@@ -1349,6 +1704,7 @@ int poke(lua_State *L)
 
         m_memory[addr + i-2] = val;
     }
+    memory_mark_written(addr, lua_gettop(L) - 1);
 
     if (addr >= MEMORY_CARTDATA && addr + 1 <= MEMORY_CARTDATA + MEMORY_CARTDATA_SIZE)
         p8_delayed_flush_cartdata();
@@ -1370,6 +1726,7 @@ int poke2(lua_State *L)
         m_memory[addr + (i-2)*2] = val;
         m_memory[addr + (i-2)*2 + 1] = val >> 8;
     }
+    memory_mark_written(addr, (lua_gettop(L) - 1) * 2);
 
     if (addr >= MEMORY_CARTDATA && addr + 2 <= MEMORY_CARTDATA + MEMORY_CARTDATA_SIZE)
         p8_delayed_flush_cartdata();
@@ -1393,6 +1750,7 @@ int poke4(lua_State *L)
         m_memory[addr + (i-2)*4 + 2] = val >> 16;
         m_memory[addr + (i-2)*4 + 3] = val >> 24;
     }
+    memory_mark_written(addr, (lua_gettop(L) - 1) * 4);
 
     if (addr >= MEMORY_CARTDATA && addr + 4 <= MEMORY_CARTDATA + MEMORY_CARTDATA_SIZE)
         p8_delayed_flush_cartdata();
@@ -1434,8 +1792,10 @@ int reload(lua_State *L)
     } else {
         src_mem = m_cart_memory;
     }
-    if (destaddr >= 0 && destaddr + len <= 0x10000 && srcaddr >= 0 && srcaddr + len <= CART_MEMORY_SIZE)
+    if (destaddr >= 0 && destaddr + len <= 0x10000 && srcaddr >= 0 && srcaddr + len <= CART_MEMORY_SIZE) {
         memcpy(m_memory + destaddr, src_mem + srcaddr, len);
+        memory_mark_written(destaddr, len);
+    }
     lua_pushinteger(L, len);
     return 1;
 }
@@ -1563,7 +1923,19 @@ int dset(lua_State *L)
 // cocreate(func)
 // coresume(cor)
 // costatus(cor)
+// These are coroutine.create, coroutine.resume and coroutine.status.
+
+static int yield_done(lua_State *L)
+{
+    return 0;
+}
+
 // yield()
+int _yield(lua_State *L)
+{
+    // Values passed to coresume() are dropped.
+    return lua_yieldk(L, 0, 0, yield_done);
+}
 
 // ****************************************************************
 // *** Values and objects ***
@@ -1828,8 +2200,8 @@ int lua_stat(lua_State *L)
     switch (n)
     {
     case STAT_MEM_USAGE: {
-        lua_gc(L, LUA_GCCOLLECT, 0);
-        int kb = lua_gc(L, LUA_GCCOUNT, 0);
+        // Exact from the allocator, so no collection is needed first.
+        int kb = (int)(alloc_usage() / 1024);
         lua_pushnumber(L, fix32_from_int(kb));
         break;
     }
@@ -1840,6 +2212,11 @@ int lua_stat(lua_State *L)
     }
     case STAT_CPU_USAGE:
     case STAT_SYSTEM_CPU_USAGE: {
+        // Wall-clock frame time would differ from run to run of a replay.
+        if (replay_is_active()) {
+            lua_pushnumber(L, fix32_from_bits((int32_t)m_replay_calls));
+            break;
+        }
         unsigned elapsed_time = p8_elapsed_time();
         const unsigned target_frame_time = 1000 / m_fps;
         float f = (float)elapsed_time / (float)target_frame_time;
@@ -1918,8 +2295,9 @@ int lua_stat(lua_State *L)
     case STAT_HOUR:
     case STAT_MINUTE:
     case STAT_SECOND: {
-        time_t t = time(NULL);
-        struct tm *tm = localtime(&t);
+        time_t t = p8_time();
+        // The virtual clock must not depend on the host time zone.
+        struct tm *tm = replay_is_active() ? gmtime(&t) : localtime(&t);
         switch (n)
         {
         case STAT_YEAR:
@@ -1949,7 +2327,7 @@ int lua_stat(lua_State *L)
     case STAT_HOUR_UTC:
     case STAT_MINUTE_UTC:
     case STAT_SECOND_UTC: {
-        time_t t = time(NULL);
+        time_t t = p8_time();
         struct tm *tm = gmtime(&t);
         switch (n)
         {
@@ -2116,7 +2494,7 @@ int serial(lua_State *L)
 
         if (length > 0) {
             size_t bytes_read = fread(m_memory + address, 1, length, stdin);
-            (void)bytes_read;
+            memory_mark_written(address, bytes_read);
         }
         break;
     }
@@ -2328,79 +2706,171 @@ static int lua_new(lua_State *L)
     return 0;
 }
 
+// API functions registered by lua_register_functions, so that the profiler
+// can swap timing wrappers in and out of the globals.
+typedef struct {
+    const char *name;
+    lua_CFunction fn;
+    int profile_slot; // -1 if the function is never timed
+} api_function_t;
+
+#define API_FUNCTION_MAX 128
+
+static api_function_t m_api_functions[API_FUNCTION_MAX];
+static int m_api_function_count = 0;
+static bool m_api_profiled = false;
+
+static int api_profile_call(lua_State *L)
+{
+    const api_function_t *f = lua_touserdata(L, lua_upvalueindex(1));
+    p8_clock_t start = p8_clock();
+    int ret = f->fn(L);
+    profile_api_end(f->profile_slot, start);
+    return ret;
+}
+
+static void push_api_function(lua_State *L, api_function_t *f, bool profiled)
+{
+    if (profiled && f->profile_slot >= 0) {
+        lua_pushlightuserdata(L, f);
+        lua_pushcclosure(L, api_profile_call, 1);
+    } else {
+        lua_pushcfunction(L, f->fn);
+    }
+}
+
+static void register_api_timed(lua_State *L, const char *name, lua_CFunction fn, bool timed)
+{
+    assert(m_api_function_count < API_FUNCTION_MAX);
+    api_function_t *f = &m_api_functions[m_api_function_count++];
+    f->name = name;
+    f->fn = fn;
+    f->profile_slot = timed ? profile_api_register(name) : -1;
+    push_api_function(L, f, m_profile_enabled);
+    lua_setglobal(L, name);
+}
+
+static void register_api(lua_State *L, const char *name, lua_CFunction fn)
+{
+    register_api_timed(L, name, fn, true);
+}
+
+// Functions that yield or run Lua code are not timed: a yield never returns
+// through the wrapper, and nested Lua code would be counted against them.
+static void register_untimed_api(lua_State *L, const char *name, lua_CFunction fn)
+{
+    register_api_timed(L, name, fn, false);
+}
+
+// Register coroutine.<field> as the global name.
+static void register_coroutine_api(lua_State *L, const char *name, const char *field, bool timed)
+{
+    lua_getglobal(L, "coroutine");
+    lua_getfield(L, -1, field);
+    lua_CFunction fn = lua_tocfunction(L, -1);
+    lua_pop(L, 2);
+    register_api_timed(L, name, fn, timed);
+}
+
+// Follow the profiler being switched on or off. Globals the cart has
+// redefined are left alone.
+static void update_api_profiling(lua_State *L)
+{
+    if (m_api_profiled == m_profile_enabled)
+        return;
+    for (int i = 0; i < m_api_function_count; i++) {
+        api_function_t *f = &m_api_functions[i];
+        lua_getglobal(L, f->name);
+        bool current = lua_tocfunction(L, -1) == f->fn;
+        if (!current && lua_tocfunction(L, -1) == api_profile_call && lua_getupvalue(L, -1, 1)) {
+            current = lua_touserdata(L, -1) == f;
+            lua_pop(L, 1);
+        }
+        lua_pop(L, 1);
+        if (current) {
+            push_api_function(L, f, m_profile_enabled);
+            lua_setglobal(L, f->name);
+        }
+    }
+    m_api_profiled = m_profile_enabled;
+}
+
 void lua_register_functions(lua_State *L)
 {
+    m_api_function_count = 0;
+
     // ****************************************************************
     // *** Graphics ***
     // ****************************************************************
-    lua_register(L, "camera", camera);
-    lua_register(L, "circ", circ);
-    lua_register(L, "circfill", circfill);
-    lua_register(L, "clip", clip);
-    lua_register(L, "cls", cls);
-    lua_register(L, "color", color);
-    lua_register(L, "cursor", cursor);
-    lua_register(L, "fget", fget);
-    lua_register(L, "fillp", fillp);
-    lua_register(L, "flip", flip);
-    lua_register(L, "holdframe", holdframe);
-    lua_register(L, "fset", fset);
-    lua_register(L, "line", line);
-    lua_register(L, "oval", oval);
-    lua_register(L, "ovalfill", ovalfill);
-    lua_register(L, "pal", pal);
-    lua_register(L, "palt", palt);
-    lua_register(L, "pget", pget);
-    lua_register(L, "print", print);
-    lua_register(L, "pset", pset);
-    lua_register(L, "rect", rect);
-    lua_register(L, "rectfill", rectfill);
-    lua_register(L, "rrect", rrect);
-    lua_register(L, "rrectfill", rrectfill);
-    lua_register(L, "sget", sget);
-    lua_register(L, "spr", spr);
-    lua_register(L, "sset", sset);
-    lua_register(L, "sspr", sspr);
-    lua_register(L, "tline", tline);
+    register_api(L, "camera", camera);
+    register_api(L, "circ", circ);
+    register_api(L, "circfill", circfill);
+    register_api(L, "clip", clip);
+    register_api(L, "cls", cls);
+    register_api(L, "color", color);
+    register_api(L, "cursor", cursor);
+    register_api(L, "fget", fget);
+    register_api(L, "fillp", fillp);
+    register_untimed_api(L, "flip", flip);
+    register_api(L, "holdframe", holdframe);
+    register_api(L, "fset", fset);
+    register_api(L, "line", line);
+    register_api(L, "oval", oval);
+    register_api(L, "ovalfill", ovalfill);
+    register_api(L, "pal", pal);
+    register_api(L, "palt", palt);
+    register_api(L, "pget", pget);
+    register_api(L, "print", print);
+    register_api(L, "pset", pset);
+    register_api(L, "rect", rect);
+    register_api(L, "rectfill", rectfill);
+    register_api(L, "rrect", rrect);
+    register_api(L, "rrectfill", rrectfill);
+    register_api(L, "sget", sget);
+    register_api(L, "spr", spr);
+    register_api(L, "sset", sset);
+    register_api(L, "sspr", sspr);
+    register_api(L, "tline", tline);
     // ****************************************************************
     // *** Tables ***
     // ****************************************************************
-    // lua_register(L, "add", add);
-    // lua_register(L, "all", all);
-    // lua_register(L, "count", count);
-    // lua_register(L, "del", del);
-    // lua_register(L, "foreach", foreach);
+    register_api(L, "add", add);
+    register_api(L, "all", all);
+    register_api(L, "count", count);
+    register_api(L, "del", del);
+    register_api(L, "deli", deli);
+    register_untimed_api(L, "foreach", foreach);
     // lua_register(L, "pairs", pairs);
     // ****************************************************************
     // *** Input ***
     // ****************************************************************
-    lua_register(L, "btn", btn);
-    lua_register(L, "btnp", btnp);
-    lua_register(L, "_update_buttons", _update_buttons);
+    register_api(L, "btn", btn);
+    register_api(L, "btnp", btnp);
+    register_api(L, "_update_buttons", _update_buttons);
     // ****************************************************************
     // *** Sound ***
     // ****************************************************************
-    lua_register(L, "music", music);
-    lua_register(L, "sfx", sfx);
+    register_api(L, "music", music);
+    register_api(L, "sfx", sfx);
     // ****************************************************************
     // *** Map ***
     // ****************************************************************
-    lua_register(L, "map", map);
-    lua_register(L, "mget", mget);
-    lua_register(L, "mset", mset);
+    register_api(L, "map", map);
+    register_api(L, "mget", mget);
+    register_api(L, "mset", mset);
     // ****************************************************************
     // *** Memory ***
     // ****************************************************************
-    lua_register(L, "cstore", cstore);
-    lua_register(L, "memcpy", _memcpy);
-    lua_register(L, "memset", _memset);
-    lua_register(L, "peek", peek);
-    lua_register(L, "peek2", peek2);
-    lua_register(L, "peek4", peek4);
-    lua_register(L, "poke", poke);
-    lua_register(L, "poke2", poke2);
-    lua_register(L, "poke4", poke4);
-    lua_register(L, "reload", reload);
+    register_api(L, "cstore", cstore);
+    register_api(L, "memcpy", _memcpy);
+    register_api(L, "memset", _memset);
+    register_api(L, "peek", peek);
+    register_api(L, "peek2", peek2);
+    register_api(L, "peek4", peek4);
+    register_api(L, "poke", poke);
+    register_api(L, "poke2", poke2);
+    register_api(L, "poke4", poke4);
+    register_api(L, "reload", reload);
     // ****************************************************************
     // *** Math ***
     // ****************************************************************
@@ -2417,7 +2887,7 @@ void lua_register_functions(lua_State *L)
     // lua_register(L, "max", max); // in lpico8lib.c
     // lua_register(L, "mid", mid); // in lpico8lib.c
     // lua_register(L, "min", min); // in lpico8lib.c
-    lua_register(L, "rnd", rnd);
+    register_api(L, "rnd", rnd);
     // lua_register(L, "rotl", rotl); // in lpico8lib.c
     // lua_register(L, "rotr", rotr); // in lpico8lib.c
     // lua_register(L, "sgn", sgn); // in lpico8lib.c
@@ -2425,20 +2895,20 @@ void lua_register_functions(lua_State *L)
     // lua_register(L, "shr", shr); // in lpico8lib.c
     // lua_register(L, "sin", _sin); // in lpico8lib.c
     // lua_register(L, "sqrt", _sqrt); // in lpico8lib.c
-    lua_register(L, "srand", _srand);
+    register_api(L, "srand", _srand);
     // ****************************************************************
     // *** Cartridge data ***
     // ****************************************************************
-    lua_register(L, "cartdata", cartdata);
-    lua_register(L, "dget", dget);
-    lua_register(L, "dset", dset);
+    register_api(L, "cartdata", cartdata);
+    register_api(L, "dget", dget);
+    register_api(L, "dset", dset);
     // ****************************************************************
     // *** Coroutines ***
     // ****************************************************************
-    // lua_register(L, "cocreate", cocreate);
-    // lua_register(L, "coresume", coresume);
-    // lua_register(L, "costatus", costatus);
-    // lua_register(L, "yield", yield);
+    register_coroutine_api(L, "cocreate", "create", true);
+    register_coroutine_api(L, "coresume", "resume", false);
+    register_coroutine_api(L, "costatus", "status", true);
+    register_untimed_api(L, "yield", _yield);
     // ****************************************************************
     // *** Values and objects ***
     // ****************************************************************
@@ -2447,38 +2917,38 @@ void lua_register_functions(lua_State *L)
     // lua_register(L, "setmetatable", setmetatable);
     // lua_register(L, "getmetatable", getmetatable);
     // lua_register(L, "type", type);
-    lua_register(L, "sub", sub);
+    register_api(L, "sub", sub);
     // lua_register(L, "tonum", tonum);
     // lua_register(L, "tostr", tostr); // in lpico8lib.c
     // ****************************************************************
     // *** Time ***
     // ****************************************************************
-    lua_register(L, "t", _time);
-    lua_register(L, "time", _time);
+    register_api(L, "t", _time);
+    register_api(L, "time", _time);
     // ****************************************************************
     // *** System ***
     // ****************************************************************
-    lua_register(L, "menuitem", menuitem);
-    lua_register(L, "extcmd", extcmd);
-    lua_register(L, "load", _load);
-    lua_register(L, "reset", reset);
-    lua_register(L, "run", run);
-    lua_register(L, "serial", serial);
-    lua_register(L, "_set_fps", set_fps);
-    lua_register(L, "save", save);
-    lua_register(L, "ls", ls);
-    lua_register(L, "reboot", lua_reboot);
-    lua_register(L, "cd", cd);
-    lua_register(L, "mkdir", lua_mkdir);
-    lua_register(L, "new", lua_new);
+    register_api(L, "menuitem", menuitem);
+    register_api(L, "extcmd", extcmd);
+    register_api(L, "load", _load);
+    register_api(L, "reset", reset);
+    register_api(L, "run", run);
+    register_api(L, "serial", serial);
+    register_api(L, "_set_fps", set_fps);
+    register_api(L, "save", save);
+    register_api(L, "ls", ls);
+    register_api(L, "reboot", lua_reboot);
+    register_api(L, "cd", cd);
+    register_api(L, "mkdir", lua_mkdir);
+    register_api(L, "new", lua_new);
     // ****************************************************************
     // *** Debugging ***
     // ****************************************************************
     // lua_register(L, "assert", assert);
-    lua_register(L, "printh", printh);
-    lua_register(L, "stat", lua_stat);
-    lua_register(L, "stop", _stop);
-    lua_register(L, "trace", _trace);
+    register_api(L, "printh", printh);
+    register_api(L, "stat", lua_stat);
+    register_api(L, "stop", _stop);
+    register_api(L, "trace", _trace);
     // ****************************************************************
     // *** Misc ***
     // ****************************************************************
@@ -2513,21 +2983,141 @@ void lua_register_functions(lua_State *L)
     lua_pushnumber(L, fix32_from_bits(0x7adf8000)); lua_setglobal(L, "\x96");  // 150 ∧
     lua_pushnumber(L, fix32_from_bits(0x0f0f8000)); lua_setglobal(L, "\x98");  // 152 ▤
     lua_pushnumber(L, fix32_from_bits(0x55558000)); lua_setglobal(L, "\x99");  // 153 ▥
+
+    m_api_profiled = m_profile_enabled;
 }
 
 static void lua_event_pump_hook(lua_State *L, lua_Debug *ar)
 {
     (void)L;
-    (void)ar;
+    if (ar->event != LUA_HOOKCOUNT) {
+        m_replay_calls++;
+        return;
+    }
     p8_pump_events();
     p8_check_for_pause();
 }
 
+static int lua_panic(lua_State *L)
+{
+    fprintf(stderr, "PANIC: unprotected error in call to Lua API (%s)\n",
+            lua_tostring(L, -1));
+    return 0;
+}
+
+// Idle-time garbage collection state, reset with each new Lua state.
+static bool gc_idle_only = false;
+static bool gc_stopped = false;
+static bool gc_cycle_active = false;
+static size_t gc_live = 0;           // bytes in use when the last idle cycle finished
+static size_t gc_last_usage = 0;     // bytes in use after the last idle call
+static unsigned gc_alloc_kb = 0;     // smoothed KB allocated per frame
+static unsigned gc_ns_per_kb = 0;    // smoothed cost of collecting 1 KB of debt
+
+static lua_State *lua_new_state(void)
+{
+    // A random string hash seed would change how much each collection step
+    // frees, and so stat(0), from one run of a replay to the next.
+    lua_setfixedseed(replay_is_active() ? GC_REPLAY_STRING_SEED : 0);
+    lua_State *state = lua_newstate(alloc_lua, NULL);
+    if (state)
+        lua_atpanic(state, lua_panic);
+    gc_stopped = false;
+    gc_cycle_active = false;
+    gc_live = 0;
+    gc_last_usage = 0;
+    gc_alloc_kb = 0;
+    return state;
+}
+
+void lua_frame_start(void)
+{
+    m_replay_calls = 0;
+}
+
+void lua_set_gc_idle_only(bool idle_only)
+{
+    gc_idle_only = idle_only;
+}
+
+void lua_gc_idle(unsigned budget_us)
+{
+    if (!L)
+        return;
+
+    p8_clock_t start = p8_clock();
+    size_t usage = alloc_usage();
+    unsigned allocated_kb = usage > gc_last_usage ? (unsigned)((usage - gc_last_usage) / 1024) : 0;
+    gc_alloc_kb = (gc_alloc_kb * 3 + allocated_kb) / 4;
+
+    if (gc_idle_only) {
+        // Only collect here, unless idle time is not keeping up with the
+        // cart: then let the collector run inside frames again (which also
+        // re-enables Lua's emergency collection when an allocation fails).
+        size_t limit = alloc_get_limit();
+        bool behind = usage > 2 * gc_live + GC_IDLE_HEADROOM ||
+                      (limit != 0 && usage > limit / 4 * 3);
+        if (behind == gc_stopped) {
+            lua_gc(L, behind ? LUA_GCRESTART : LUA_GCSTOP, 0);
+            gc_stopped = !behind;
+        }
+    }
+
+    // Start a cycle once the cart has allocated half as much again as was
+    // live after the last one, or will reach Lua's own trigger (twice that)
+    // within a few frames, so the collector seldom has to start mid-frame.
+    size_t expected = usage + (size_t)gc_alloc_kb * 1024 * GC_IDLE_LOOKAHEAD_FRAMES;
+    if (!gc_cycle_active && usage < gc_live + gc_live / 2 && expected < 2 * gc_live) {
+        gc_last_usage = usage;
+        return;
+    }
+    gc_cycle_active = true;
+
+    if (replay_is_active()) {
+        // The time budget differs from run to run, so a replay collects a
+        // fixed amount each frame instead.
+        if (lua_gc(L, LUA_GCSTEP, GC_REPLAY_STEP_KB)) {
+            gc_cycle_active = false;
+            gc_live = alloc_usage();
+        }
+        gc_last_usage = alloc_usage();
+        return;
+    }
+
+    for (;;) {
+        unsigned spent = p8_clock_us(p8_clock_delta(start, p8_clock()));
+        if (spent >= budget_us)
+            break;
+        // Size each slice to fill half of the remaining budget at the
+        // measured cost, so a bad estimate cannot overrun it by much.
+        unsigned remaining_ns = (budget_us - spent) * 1000;
+        if (gc_ns_per_kb > remaining_ns)
+            break;
+        int kb = gc_ns_per_kb ? (int)(remaining_ns / 2 / gc_ns_per_kb) : 1;
+        if (kb < 1)
+            kb = 1;
+
+        p8_clock_t step_start = p8_clock();
+        int finished = lua_gc(L, LUA_GCSTEP, kb);
+        unsigned ns_per_kb = p8_clock_us(p8_clock_delta(step_start, p8_clock())) * 1000 / kb;
+        gc_ns_per_kb = gc_ns_per_kb ? (gc_ns_per_kb * 3 + ns_per_kb) / 4 : ns_per_kb;
+
+        if (finished) {
+            gc_cycle_active = false;
+            gc_live = alloc_usage();
+            break;
+        }
+    }
+    gc_last_usage = alloc_usage();
+}
+
 int lua_load_api()
 {
     if (!L)
     {
-        L = luaL_newstate();
+        L = lua_new_state();
+        if (!L)
+            return LUA_ERRMEM;
     }
 
     luaL_openlibs(L);
@@ -2539,8 +3129,10 @@ int lua_load_api()
         return ret;
     lua_setpico8memory(L, m_memory);
 
-    // Set debug hook to pump events every ~3000 instructions
-    lua_sethook(L, lua_event_pump_hook, LUA_MASKCOUNT, 3000);
+    // Set debug hook to pump events every ~3000 instructions, and to count
+    // calls for the CPU stats during a replay
+    m_replay_calls = 0;
+    lua_sethook(L, lua_event_pump_hook, LUA_MASKCOUNT | (replay_is_active() ? LUA_MASKCALL : 0), 3000);
 
     return 0;
 }
@@ -2551,6 +3143,7 @@ int lua_shutdown_api()
         p8_menuitem_reset_all();
         lua_close(L);
         L = NULL;
+        alloc_reset();
     }
     return 0;
 }
@@ -2605,7 +3198,9 @@ void lua_print_error()
 int lua_init_script(const char *file_name, const char *script)
 {
     if (!L)
-        L = luaL_newstate();
+        L = lua_new_state();
+    if (!L)
+        return LUA_ERRMEM;
 
     char temp_file_name[PATH_MAX + 1];
     temp_file_name[0] = '@';
@@ -2617,10 +3212,17 @@ int lua_init_script(const char *file_name, const char *script)
     lua_settop(L, 0);
 
     size_t script_len = strnlen(script, LUA_SCRIPT_SIZE);
-    m_status = luaL_loadbuffer(L, script, script_len, temp_file_name);
+    // Headless runs leave no files behind.
+    bool use_cache = !p8_is_headless();
+    if (!use_cache || bytecode_cache_load(L, script, script_len, temp_file_name) != 0) {
+        m_status = luaL_loadbuffer(L, script, script_len, temp_file_name);
 
-    if (m_status)
-        return m_status;
+        if (m_status)
+            return m_status;
+
+        if (use_cache)
+            bytecode_cache_store(L, script, script_len, temp_file_name);
+    }
 
     m_status = lua_pcall(L, 0, 0, 0);
 
@@ -2695,6 +3297,7 @@ int lua_update()
 
     lua_settop(L, 0);
     m_status = 0;
+    update_api_profiling(L);
 
     if (m_lua_update60)
         return lua_call_function("_update60", 0);
@@ -2715,6 +3318,7 @@ int lua_draw()
 
     lua_settop(L, 0);
     m_status = 0;
+    update_api_profiling(L);
 
     if (m_lua_draw)
         return lua_call_function("_draw", 0);
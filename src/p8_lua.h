@@ -20,6 +20,13 @@ int lua_update();
 int lua_draw();
 int lua_init();
 bool lua_has_main_loop_callbacks();
+/* Collect garbage for at most budget_us, in time the frame would sleep.
+   During a replay a fixed step is collected instead, whatever the budget. */
+void lua_gc_idle(unsigned budget_us);
+/* Start counting the work done in a new frame. */
+void lua_frame_start(void);
+/* Keep the collector stopped during frames, collecting only in lua_gc_idle(). */
+void lua_set_gc_idle_only(bool idle_only);
 int lua_exec_repl(const char *input);
 void lua_get_error(const char **err_type, char *err, int err_size, const char **filename, int *lineno);
 
@@ -46,6 +46,7 @@ static inline uint8_t color_get(int type, int index);
 static inline void color_set(int type, int index, int col);
 static inline void clip_get(int *x0, int *y0, int *x1, int *y1);
 static inline void clip_set(int x, int y, int w, int h);
+static inline const draw_state_t *draw_state_get(void);
 static inline void cursor_get(int *x, int *y);
 static inline void cursor_set(int x, int y, int col);
 static inline void pixel_set(int x, int y, int c, int fillp, int draw_type);
@@ -86,37 +87,40 @@ static inline int dash_direction_y(int facing)
 // outside the effective clip region (clip rect intersected with screen bounds).
 static inline bool is_bbox_offscreen(int wx0, int wy0, int wx1, int wy1)
 {
-    int cx, cy;
-    camera_get(&cx, &cy);
-    int ccx0, ccy0, ccx1, ccy1;
-    clip_get(&ccx0, &ccy0, &ccx1, &ccy1);
-    if (ccx0 < 0) ccx0 = 0;
-    if (ccy0 < 0) ccy0 = 0;
-    if (ccx1 > P8_WIDTH)  ccx1 = P8_WIDTH;
-    if (ccy1 > P8_HEIGHT) ccy1 = P8_HEIGHT;
-    int sx0 = wx0 - cx, sy0 = wy0 - cy;
-    int sx1 = wx1 - cx, sy1 = wy1 - cy;
-    return sx1 < ccx0 || sx0 >= ccx1 || sy1 < ccy0 || sy0 >= ccy1;
+    const draw_state_t *ds = draw_state_get();
+    int sx0 = wx0 - ds->cx, sy0 = wy0 - ds->cy;
+    int sx1 = wx1 - ds->cx, sy1 = wy1 - ds->cy;
+    return sx1 < ds->clip_x0 || sx0 >= ds->clip_x1 || sy1 < ds->clip_y0 || sy0 >= ds->clip_y1;
+}
+
+// Scale a circle coordinate v of radius r onto an oval radius s.
+static inline int oval_scale(int v, int s, int r)
+{
+    return s == r ? v : v * s / r;
 }
 
 static inline void draw_oval_segment(int xc, int yc, int x, int y, int r, int xr, int yr, int col, int fillp, int mask)
 {
+    int xx = oval_scale(x, xr, r);
+    int yy = oval_scale(y, yr, r);
+    int yx = oval_scale(y, xr, r);
+    int xy = oval_scale(x, yr, r);
     if (mask & 1)
-        pixel_set(xc + x * xr / r, yc + y * yr / r, col, fillp, DRAWTYPE_GRAPHIC);
+        pixel_set(xc + xx, yc + yy, col, fillp, DRAWTYPE_GRAPHIC);
     if (mask & 2)
-        pixel_set(xc - x * xr / r, yc + y * yr / r, col, fillp, DRAWTYPE_GRAPHIC);
+        pixel_set(xc - xx, yc + yy, col, fillp, DRAWTYPE_GRAPHIC);
     if (mask & 4)
-        pixel_set(xc + x * xr / r, yc - y * yr / r, col, fillp, DRAWTYPE_GRAPHIC);
+        pixel_set(xc + xx, yc - yy, col, fillp, DRAWTYPE_GRAPHIC);
     if (mask & 8)
-        pixel_set(xc - x * xr / r, yc - y * yr / r, col, fillp, DRAWTYPE_GRAPHIC);
+        pixel_set(xc - xx, yc - yy, col, fillp, DRAWTYPE_GRAPHIC);
     if (mask & 16)
-        pixel_set(xc + y * xr / r, yc + x * yr / r, col, fillp, DRAWTYPE_GRAPHIC);
+        pixel_set(xc + yx, yc + xy, col, fillp, DRAWTYPE_GRAPHIC);
     if (mask & 32)
-        pixel_set(xc - y * xr / r, yc + x * yr / r, col, fillp, DRAWTYPE_GRAPHIC);
+        pixel_set(xc - yx, yc + xy, col, fillp, DRAWTYPE_GRAPHIC);
     if (mask & 64)
-        pixel_set(xc + y * xr / r, yc - x * yr / r, col, fillp, DRAWTYPE_GRAPHIC);
+        pixel_set(xc + yx, yc - xy, col, fillp, DRAWTYPE_GRAPHIC);
     if (mask & 128)
-        pixel_set(xc - y * xr / r, yc - x * yr / r, col, fillp, DRAWTYPE_GRAPHIC);
+        pixel_set(xc - yx, yc - xy, col, fillp, DRAWTYPE_GRAPHIC);
 }
 
 static inline void draw_oval_mask(int xc, int yc, int xr, int yr, int col, int fillp, int mask)
@@ -156,107 +160,256 @@ static inline void draw_circ(int xc, int yc, int r, int col, int fillp)
     draw_circ_mask(xc, yc, r, col, fillp, 0xff);
 }
 
-static inline void draw_line(int x0, int y0, int x1, int y1, int col, int fillp)
+// Fill state for DRAWTYPE_GRAPHIC spans, resolved once per primitive. The
+// fill pattern, transparency, secondary palette and rw mask are folded into
+// a value and a write mask for the two byte phases of each pattern row, so
+// spans are written a byte at a time as (dst & ~mask) | value.
+typedef struct {
+    uint8_t *screen;
+    int cx, cy;
+    int clip_x0, clip_y0, clip_x1, clip_y1;
+    uint8_t value[4][2];
+    uint8_t mask[4][2];
+} span_fill_t;
+
+static inline void span_fill_init(span_fill_t *f, int c, int fillp)
 {
-    if (is_bbox_offscreen(MIN(x0, x1), MIN(y0, y1), MAX(x0, x1), MAX(y0, y1))) return;
-    int dx = abs(x1 - x0);
-    int sx = x0 < x1 ? 1 : -1;
-    int dy = -abs(y1 - y0);
-    int sy = y0 < y1 ? 1 : -1;
-    int err = dx + dy;
+    const draw_state_t *ds = draw_state_get();
+    bool transparency, fillp_graphics_secondary;
+    if (c & 0x1000) {
+        transparency = (c & 0x100) != 0;
+        fillp_graphics_secondary = (c & 0x400) != 0;
+    } else {
+        fillp = ds->fillp;
+        transparency = ds->fillp_transparent;
+        fillp_graphics_secondary = ds->fillp_graphics_secondary;
+    }
+    if (c == -1)
+        c = pencolor_get();
+
+    uint8_t col_on, col_off;
+    if (fillp_graphics_secondary) {
+        uint8_t col_secondary = color_get(PALTYPE_SECONDARY, ds->draw_pal[c & 0xf]);
+        col_on = (col_secondary >> 4) & 0xf;
+        col_off = col_secondary & 0xf;
+    } else {
+        col_on = ds->draw_pal[(c >> 4) & 0xf] & 0xf;
+        col_off = ds->draw_pal[c & 0xf] & 0xf;
+    }
 
-    while (true)
-    {
-        pixel_set(x0, y0, col, fillp, DRAWTYPE_GRAPHIC);
+    uint8_t write_mask = (ds->rw_mask & 0xf) * 0x11;
+    uint8_t read_mask = (ds->rw_mask >> 4) * 0x11;
+
+    for (int row = 0; row < 4; row++) {
+        for (int phase = 0; phase < 2; phase++) {
+            uint8_t value = 0, mask = 0;
+            for (int i = 0; i < 2; i++) {
+                unsigned bit = (3 - row) * 4 + (3 - (phase * 2 + i));
+                bool on = (fillp & (1 << bit)) != 0;
+                if (transparency && on)
+                    continue;
+                value |= (on ? col_on : col_off) << (4 * i);
+                mask |= 0xf << (4 * i);
+            }
+            mask &= write_mask;
+            f->value[row][phase] = value & mask & read_mask;
+            f->mask[row][phase] = mask;
+        }
+    }
 
-        if (x0 == x1 && y0 == y1)
-            break;
+    f->cx = ds->cx;
+    f->cy = ds->cy;
+    f->clip_x0 = ds->clip_x0;
+    f->clip_y0 = ds->clip_y0;
+    f->clip_x1 = ds->clip_x1;
+    f->clip_y1 = ds->clip_y1;
+    f->screen = ds->screen;
+}
 
-        int e2 = 2 * err;
+// Fill screen pixels x0..x1 of row y, which must already be clipped.
+static inline void span_fill_screen_row(const span_fill_t *f, int x0, int x1, int y)
+{
+    uint8_t *line = f->screen + y * 64;
+    const uint8_t *value = f->value[y & 3];
+    const uint8_t *mask = f->mask[y & 3];
+    int b = x0 >> 1;
+    int last = x1 >> 1;
+    uint8_t edge0 = IS_EVEN(x0) ? 0xff : 0xf0;
+    uint8_t edge1 = IS_EVEN(x1) ? 0x0f : 0xff;
+
+    screen_mark_dirty_rows(y, y);
+    if (b == last) {
+        uint8_t m = mask[b & 1] & edge0 & edge1;
+        line[b] = (line[b] & ~m) | (value[b & 1] & m);
+        return;
+    }
+    uint8_t m = mask[b & 1] & edge0;
+    line[b] = (line[b] & ~m) | (value[b & 1] & m);
+    b++;
+    if (mask[0] == 0xff && mask[1] == 0xff && value[0] == value[1]) {
+        memset(line + b, value[0], last - b);
+    } else {
+        for (int i = b; i < last; i++)
+            line[i] = (line[i] & ~mask[i & 1]) | value[i & 1];
+    }
+    m = mask[last & 1] & edge1;
+    line[last] = (line[last] & ~m) | (value[last & 1] & m);
+}
 
-        if (e2 >= dy)
-        {
-            err += dy;
+// Fill pixels x0..x1 of row y, given in camera coordinates.
+static inline void span_fill_row(const span_fill_t *f, int x0, int x1, int y)
+{
+    x0 -= f->cx;
+    x1 -= f->cx;
+    y -= f->cy;
+    if (y < MAX(f->clip_y0, 0) || y >= f->clip_y1)
+        return;
+    x0 = MAX(x0, MAX(f->clip_x0, 0));
+    x1 = MIN(x1, f->clip_x1 - 1);
+    if (x0 > x1)
+        return;
+    span_fill_screen_row(f, x0, x1, y);
+}
 
-            x0 += sx;
-        }
+static inline void draw_hline(int x0, int y, int x1, int col, int fillp)
+{
+    span_fill_t f;
+    span_fill_init(&f, col, fillp);
+    span_fill_row(&f, x0, x1, y);
+}
 
-        if (e2 <= dx)
-        {
-            err += dx;
-            y0 += sy;
-        }
-    }
+// Set screen pixel (x, y), which must already be clipped. The caller marks
+// the row dirty.
+static inline void span_fill_screen_pixel(const span_fill_t *f, int x, int y)
+{
+    uint8_t *p = f->screen + y * 64 + (x >> 1);
+    int phase = (x >> 1) & 1;
+    uint8_t m = f->mask[y & 3][phase] & (IS_EVEN(x) ? 0x0f : 0xf0);
+    *p = (*p & ~m) | (f->value[y & 3][phase] & m);
 }
 
-static inline void draw_hline(int x0, int y, int x1, int col, int fillp)
+// Fill pixels y0..y1 of column x, given in camera coordinates.
+static inline void span_fill_column(const span_fill_t *f, int x, int y0, int y1)
 {
-    uint16_t fillp_reg = m_memory[MEMORY_FILLP] | (m_memory[MEMORY_FILLP + 1] << 8);
-    bool fillp_graphics_secondary = (m_memory[MEMORY_FILLP_ATTR] & 4) != 0;
-    if ((col & 0x1000) == 0 && fillp_reg == 0 && !fillp_graphics_secondary && m_memory[MEMORY_RW_MASK] == 0xff) {
-        // Optimized version for common case: no fillp, no rw mask.
-        int cx, cy;
-        camera_get(&cx, &cy);
-        x0 -= cx;
-        y -= cy;
-        x1 -= cx;
-        int cx0, cy0, cx1, cy1;
-        clip_get(&cx0, &cy0, &cx1, &cy1);
-
-        if (y < cy0 || y >= cy1 || y < 0 || y >= P8_HEIGHT) return;
-
-        if (x0 < cx0) x0 = cx0;
-        if (x1 > cx1) x1 = cx1;
-        if (x0 < 0) x0 = 0;
-        if (x1 > P8_WIDTH - 1) x1 = P8_WIDTH - 1;
-
-        if (x0 > x1) return;  // entirely off-screen after clipping
-
-        int base_screen_offset = gfx_addr_remap(MEMORY_SCREEN);
-        int screen_offset = base_screen_offset + (x0 >> 1) + y * 64;
-        int c = color_get(PALTYPE_DRAW, col);
-        if (!IS_EVEN(x0)) {
-            m_memory[screen_offset] = (c << 4) | (m_memory[screen_offset] & 0xF);
-            x0++;
-            screen_offset += 1;
-        }
-        for (int x=x0;x<=x1-1;x+=2) {
-            m_memory[screen_offset] = (c << 4) | (c & 0xF);
-            screen_offset += 1;
-        }
-        if (IS_EVEN(x1))
-            m_memory[screen_offset] = (m_memory[screen_offset] & 0xF0) | (c & 0xF);
+    x -= f->cx;
+    y0 -= f->cy;
+    y1 -= f->cy;
+    if (x < MAX(f->clip_x0, 0) || x >= f->clip_x1)
         return;
-    }
-
-    for (int x=x0;x<=x1;x++)
-        pixel_set(x, y, col, fillp, DRAWTYPE_GRAPHIC);
+    y0 = MAX(y0, MAX(f->clip_y0, 0));
+    y1 = MIN(y1, f->clip_y1 - 1);
+    if (y0 > y1)
+        return;
+    screen_mark_dirty_rows(y0, y1);
+    for (int y = y0; y <= y1; y++)
+        span_fill_screen_pixel(f, x, y);
 }
 
 static inline void draw_vline(int x, int y0, int y1, int col, int fillp)
 {
-    for (int y=y0;y<=y1;y++)
-        pixel_set(x, y, col, fillp, DRAWTYPE_GRAPHIC);
+    span_fill_t f;
+    span_fill_init(&f, col, fillp);
+    span_fill_column(&f, x, y0, y1);
 }
 
-static inline void draw_ovalfill_segment(int xc, int yc, int x, int y, int r, int xr, int yr, int col, int fillp, int mask)
+static inline int64_t div_ceil(int64_t a, int64_t b)
 {
-    if (mask & 1)
-        draw_hline(xc, yc + y * yr / r, xc + x * xr / r, col, fillp);
-    if (mask & 2)
-        draw_hline(xc - x * xr / r, yc + y * yr / r, xc, col, fillp);
-    if (mask & 4)
-        draw_hline(xc, yc - y * yr / r, xc + x * xr / r, col, fillp);
-    if (mask & 8)
-        draw_hline(xc - x * xr / r, yc - y * yr / r, xc, col, fillp);
-    if (mask & 16)
-        draw_hline(xc, yc + x * yr / r, xc + y * xr / r, col, fillp);
-    if (mask & 32)
-        draw_hline(xc - y * xr / r, yc + x * yr / r, xc, col, fillp);
-    if (mask & 64)
-        draw_hline(xc, yc - x * yr / r, xc + y * xr / r, col, fillp);
-    if (mask & 128)
-        draw_hline(xc - y * xr / r, yc - x * yr / r, xc, col, fillp);
+    return a >= 0 ? (a + b - 1) / b : -(-a / b);
+}
+
+// Narrow [*t0, *t1] to the steps t for which start + dir * t lies in
+// [lo, hi].
+static inline void line_clip_axis(int64_t *t0, int64_t *t1, int start, int dir, int lo, int hi)
+{
+    if (dir > 0) {
+        *t0 = MAX(*t0, lo - start);
+        *t1 = MIN(*t1, hi - start);
+    } else {
+        *t0 = MAX(*t0, start - hi);
+        *t1 = MIN(*t1, start - lo);
+    }
+}
+
+// Bresenham line. Step t along the major axis lands on minor axis step
+// (2 * t * rise + len) / (2 * len), so the segment is clipped to the clip
+// rectangle up front and only its visible points are visited.
+static inline void draw_line(int x0, int y0, int x1, int y1, int col, int fillp)
+{
+    if (is_bbox_offscreen(MIN(x0, x1), MIN(y0, y1), MAX(x0, x1), MAX(y0, y1))) return;
+
+    span_fill_t f;
+    span_fill_init(&f, col, fillp);
+    if (y0 == y1) {
+        span_fill_row(&f, MIN(x0, x1), MAX(x0, x1), y0);
+        return;
+    }
+    if (x0 == x1) {
+        span_fill_column(&f, x0, MIN(y0, y1), MAX(y0, y1));
+        return;
+    }
+
+    x0 -= f.cx;
+    y0 -= f.cy;
+    x1 -= f.cx;
+    y1 -= f.cy;
+    int clip_x0 = MAX(f.clip_x0, 0), clip_x1 = f.clip_x1 - 1;
+    int clip_y0 = MAX(f.clip_y0, 0), clip_y1 = f.clip_y1 - 1;
+    int sx = x0 < x1 ? 1 : -1;
+    int sy = y0 < y1 ? 1 : -1;
+    int dx = abs(x1 - x0);
+    int dy = abs(y1 - y0);
+    bool x_major = dx >= dy;
+    int64_t len = x_major ? dx : dy;
+    int64_t rise = x_major ? dy : dx;
+
+    int64_t t0 = 0, t1 = len;
+    int64_t n0 = 0, n1 = rise;
+    if (x_major) {
+        line_clip_axis(&t0, &t1, x0, sx, clip_x0, clip_x1);
+        line_clip_axis(&n0, &n1, y0, sy, clip_y0, clip_y1);
+    } else {
+        line_clip_axis(&t0, &t1, y0, sy, clip_y0, clip_y1);
+        line_clip_axis(&n0, &n1, x0, sx, clip_x0, clip_x1);
+    }
+    if (n0 > n1)
+        return;
+    t0 = MAX(t0, div_ceil((2 * n0 - 1) * len, 2 * rise));
+    t1 = MIN(t1, div_ceil((2 * n1 + 1) * len, 2 * rise) - 1);
+    if (t0 > t1)
+        return;
+
+    int64_t num = 2 * t0 * rise + len;
+    int n = num / (2 * len);
+    int64_t rem = num % (2 * len);
+    int n_last = (2 * t1 * rise + len) / (2 * len);
+    int ya = y0 + sy * (x_major ? n : (int)t0);
+    int yb = y0 + sy * (x_major ? n_last : (int)t1);
+    screen_mark_dirty_rows(MIN(ya, yb), MAX(ya, yb));
+    for (int64_t t = t0; t <= t1; t++) {
+        if (x_major)
+            span_fill_screen_pixel(&f, x0 + sx * (int)t, y0 + sy * n);
+        else
+            span_fill_screen_pixel(&f, x0 + sx * n, y0 + sy * (int)t);
+        rem += 2 * rise;
+        if (rem >= 2 * len) {
+            rem -= 2 * len;
+            n++;
+        }
+    }
+}
+
+// Fill row yc + dy (mask bits 0-1: right, left half) and row yc - dy
+// (bits 2-3) of a filled oval out to half-width w.
+static inline void draw_ovalfill_rows(const span_fill_t *f, int xc, int yc, int dy, int w, int mask)
+{
+    for (int half = 0; half < 2; half++, dy = -dy, mask >>= 2) {
+        if ((mask & 3) == 3)
+            span_fill_row(f, xc - w, xc + w, yc + dy);
+        else if (mask & 1)
+            span_fill_row(f, xc, xc + w, yc + dy);
+        else if (mask & 2)
+            span_fill_row(f, xc - w, xc, yc + dy);
+    }
 }
 
 static inline bool fillp_invert_enabled(int color)
@@ -264,16 +417,20 @@ static inline bool fillp_invert_enabled(int color)
     return (m_memory[MEMORY_COLOR_FILLP] & 0x3) == 0x3 && (color & 0x1800) == 0x1800;
 }
 
-static inline bool point_in_oval(int x, int y, int xc, int yc, int xr, int yr)
+// Largest dx with dx^2 * yr^2 + dy^2 * xr^2 <= xr^2 * yr^2, i.e. the
+// half-width of row dy of a filled oval, or -1 if the row is empty.
+static inline int oval_half_width(int xr, int yr, int dy)
 {
-    if (xr <= 0 || yr <= 0)
-        return false;
-
-    int dx = x - xc;
-    int dy = y - yc;
-    int64_t lhs = (int64_t)dx * dx * yr * yr + (int64_t)dy * dy * xr * xr;
-    int64_t rhs = (int64_t)xr * xr * yr * yr;
-    return lhs <= rhs;
+    if (xr <= 0 || yr <= 0 || abs(dy) > yr)
+        return -1;
+    int64_t yr2 = (int64_t)yr * yr;
+    int64_t q = (int64_t)xr * xr * (yr2 - (int64_t)dy * dy) / yr2;
+    int64_t w = (int64_t)sqrt((double)q);
+    while (w * w > q)
+        w--;
+    while ((w + 1) * (w + 1) <= q)
+        w++;
+    return (int)w;
 }
 
 static inline void draw_ovalfill_mask(int xc, int yc, int xr, int yr, int col, int fillp, int mask)
@@ -281,26 +438,35 @@ static inline void draw_ovalfill_mask(int xc, int yc, int xr, int yr, int col, i
     int r = MAX(xr, yr);
     if (r <= 0)
         return;
-    if (!fillp_invert_enabled(col) && is_bbox_offscreen(xc - xr, yc - yr, xc + xr, yc + yr)) return;
+    bool invert = fillp_invert_enabled(col);
+    if (!invert && is_bbox_offscreen(xc - xr, yc - yr, xc + xr, yc + yr)) return;
 
-    if (fillp_invert_enabled(col)) {
-        int left = xc - xr;
-        int top = yc - yr;
-        int right = xc + xr;
-        int bottom = yc + yr;
+    span_fill_t f;
+    span_fill_init(&f, col, fillp);
+
+    if (invert) {
+        // Fill the bounding box outside the oval.
+        int top = MAX(yc - yr, MAX(f.clip_y0, 0) + f.cy);
+        int bottom = MIN(yc + yr, f.clip_y1 - 1 + f.cy);
         for (int y = top; y <= bottom; y++) {
-            for (int x = left; x <= right; x++) {
-                if (!point_in_oval(x, y, xc, yc, xr, yr))
-                    pixel_set(x, y, col, fillp, DRAWTYPE_GRAPHIC);
+            int w = oval_half_width(xr, yr, y - yc);
+            if (w < 0) {
+                span_fill_row(&f, xc - xr, xc + xr, y);
+            } else {
+                span_fill_row(&f, xc - xr, xc - w - 1, y);
+                span_fill_row(&f, xc + w + 1, xc + xr, y);
             }
         }
         return;
     }
 
-    int x = 0, y = abs(r);
-    int d = 3 - 2 * abs(r);
-
-    draw_ovalfill_segment(xc, yc, x, y, r, xr, yr, col, fillp, mask);
+    // Walk the same midpoint circle as draw_oval_mask, scaled onto the oval.
+    // Each octant pair visits its rows in order and widens monotonically, so
+    // a row is filled once, at its widest, when the walk leaves it.
+    int x = 0, y = r;
+    int d = 3 - 2 * r;
+    int a_dy = oval_scale(y, yr, r), a_w = 0;
+    int b_dy = 0, b_w = oval_scale(y, xr, r);
 
     while (y >= x)
     {
@@ -314,8 +480,28 @@ static inline void draw_ovalfill_mask(int xc, int yc, int xr, int yr, int col, i
         else
             d = d + 4 * x + 6;
 
-        draw_ovalfill_segment(xc, yc, x, y, r, xr, yr, col, fillp, mask);
+        int dy = oval_scale(y, yr, r);
+        int w = oval_scale(x, xr, r);
+        if (dy != a_dy) {
+            draw_ovalfill_rows(&f, xc, yc, a_dy, a_w, mask);
+            a_dy = dy;
+            a_w = w;
+        } else {
+            a_w = MAX(a_w, w);
+        }
+
+        dy = oval_scale(x, yr, r);
+        w = oval_scale(y, xr, r);
+        if (dy != b_dy) {
+            draw_ovalfill_rows(&f, xc, yc, b_dy, b_w, mask >> 4);
+            b_dy = dy;
+            b_w = w;
+        } else {
+            b_w = MAX(b_w, w);
+        }
     }
+    draw_ovalfill_rows(&f, xc, yc, a_dy, a_w, mask);
+    draw_ovalfill_rows(&f, xc, yc, b_dy, b_w, mask >> 4);
 }
 
 static inline void draw_circfill_mask(int xc, int yc, int r, int col, int fillp, int mask)
@@ -337,102 +523,40 @@ static inline void draw_rect(int x0, int y0, int x1, int y1, int col, int fillp)
     draw_vline(x1, y0, y1, col, fillp);
 }
 
-static inline bool point_in_rect(int x, int y, int x0, int y0, int x1, int y1)
-{
-    return x >= x0 && x <= x1 && y >= y0 && y <= y1;
-}
-
 static inline void draw_rectfill(int x0, int y0, int x1, int y1, int col, int fillp)
 {
-    uint16_t fillp_reg = m_memory[MEMORY_FILLP] | (m_memory[MEMORY_FILLP + 1] << 8);
-    bool fillp_graphics_secondary = (m_memory[MEMORY_FILLP_ATTR] & 4) != 0;
-    bool invert = fillp_invert_enabled(col);
-    if (!invert && (col & 0x1000) == 0 && fillp_reg == 0 && !fillp_graphics_secondary && m_memory[MEMORY_RW_MASK] == 0xff) {
-        // Optimized version for common case: no fillp, no rw mask.
-        int cx, cy;
-        camera_get(&cx, &cy);
-        x0 -= cx;
-        y0 -= cy;
-        x1 -= cx;
-        y1 -= cy;
-        int cx0, cy0, cx1, cy1;
-        clip_get(&cx0, &cy0, &cx1, &cy1);
-
-        if (x0 < cx0) x0 = cx0;
-        if (y0 < cy0) y0 = cy0;
-        if (x1 > cx1) x1 = cx1;
-        if (y1 > cy1) y1 = cy1;
-        if (x0 < 0) x0 = 0;
-        if (y0 < 0) y0 = 0;
-        if (x1 > P8_WIDTH - 1) x1 = P8_WIDTH - 1;
-        if (y1 > P8_HEIGHT - 1) y1 = P8_HEIGHT - 1;
-
-        if (x0 > x1 || y0 > y1) return;  // entirely off-screen after clipping
-
-        int base_screen_offset = gfx_addr_remap(MEMORY_SCREEN);
-        int c = color_get(PALTYPE_DRAW, col);
-        if (!IS_EVEN(x0)) {
-            int screen_offset = base_screen_offset + (x0 >> 1) + y0 * 64;
-            for(int y=y0;y<=y1;y++) {
-                m_memory[screen_offset] = (c << 4) | (m_memory[screen_offset] & 0xF);
-                screen_offset += 64;
-            }
-            x0++;
-        }
-        if (IS_EVEN(x1)) {
-            int screen_offset = base_screen_offset + (x1 >> 1) + y0 * 64;
-            for(int y=y0;y<=y1;y++) {
-                m_memory[screen_offset] = (m_memory[screen_offset] & 0xF0) | (c & 0xF);
-                screen_offset += 64;
-            }
-            x1--;
-        }
-        for (int x=x0;x<=x1;x+=2) {
-            int screen_offset = base_screen_offset + (x >> 1) + y0 * 64;
-            for(int y=y0;y<=y1;y++) {
-                m_memory[screen_offset] = (c & 0xF) | (c << 4);
-                screen_offset += 64;
-            }
-        }
+    span_fill_t f;
+    span_fill_init(&f, col, fillp);
+    int sx0 = MAX(f.clip_x0, 0);
+    int sy0 = MAX(f.clip_y0, 0);
+    if (sx0 >= f.clip_x1)
         return;
-    }
 
-    if (invert) {
-        int cx, cy;
-        camera_get(&cx, &cy);
-        int clip_x0, clip_y0, clip_x1, clip_y1;
-        clip_get(&clip_x0, &clip_y0, &clip_x1, &clip_y1);
-
-        for (int y = clip_y0; y < clip_y1; y++) {
-            for (int x = clip_x0; x < clip_x1; x++) {
-                if (!point_in_rect(x, y, x0, y0, x1, y1))
-                    pixel_set(x + cx, y + cy, col, fillp, DRAWTYPE_GRAPHIC);
+    if (fillp_invert_enabled(col)) {
+        // Fill the clip region around the rectangle, which is given in
+        // screen coordinates.
+        for (int y = sy0; y < f.clip_y1; y++) {
+            if (y < y0 || y > y1 || x0 > x1) {
+                span_fill_screen_row(&f, sx0, f.clip_x1 - 1, y);
+                continue;
             }
+            if (x0 > sx0)
+                span_fill_screen_row(&f, sx0, MIN(x0, f.clip_x1) - 1, y);
+            if (x1 + 1 < f.clip_x1)
+                span_fill_screen_row(&f, MAX(x1 + 1, sx0), f.clip_x1 - 1, y);
         }
         return;
     }
 
-    for (int x=x0;x<=x1;x++)
-        for(int y=y0;y<=y1;y++)
-            pixel_set(x, y, col, fillp, DRAWTYPE_GRAPHIC);
-}
-
-static inline bool point_in_round_rect(int x, int y, int left, int top, int right, int bottom, int r)
-{
-    if (x < left || x > right || y < top || y > bottom)
-        return false;
-
-    if (r <= 0)
-        return true;
-
-    if (x >= left + r && x <= right - r)
-        return true;
-    if (y >= top + r && y <= bottom - r)
-        return true;
+    x0 = MAX(x0 - f.cx, sx0);
+    y0 = MAX(y0 - f.cy, sy0);
+    x1 = MIN(x1 - f.cx, f.clip_x1 - 1);
+    y1 = MIN(y1 - f.cy, f.clip_y1 - 1);
+    if (x0 > x1 || y0 > y1)
+        return;  // entirely off-screen after clipping
 
-    int cx = (x < left + r) ? (left + r) : (right - r);
-    int cy = (y < top + r) ? (top + r) : (bottom - r);
-    return point_in_oval(x, y, cx, cy, r, r);
+    for (int y = y0; y <= y1; y++)
+        span_fill_screen_row(&f, x0, x1, y);
 }
 
 static inline void draw_oval(int x0, int y0, int x1, int y1, int col, int fillp)
@@ -455,148 +579,237 @@ static inline void draw_ovalfill(int x0, int y0, int x1, int y1, int col, int fi
 
 static inline void pixel_set(int x, int y, int c, int fillp, int draw_type)
 {
-    int cx, cy;
-    camera_get(&cx, &cy);
-    x -= cx;
-    y -= cy;
-    int x0, y0, x1, y1;
-    clip_get(&x0, &y0, &x1, &y1);
+    const draw_state_t *ds = draw_state_get();
+    x -= ds->cx;
+    y -= ds->cy;
+    if (x < ds->clip_x0 || x >= ds->clip_x1 || y < ds->clip_y0 || y >= ds->clip_y1)
+        return;
 
-    if (x >= x0 && x < x1 && y >= y0 && y < y1)
-    {
-        bool fillp_sprites, fillp_graphics_secondary, transparency;
-        if (c & 0x1000) {
-            transparency = (c & 0x100) != 0;
-            fillp_sprites = (c & 0x200) != 0;
-            fillp_graphics_secondary = (c & 0x400) != 0;
-        } else {
-            fillp = m_memory[MEMORY_FILLP] | (m_memory[MEMORY_FILLP + 1] << 8);
-            transparency = (m_memory[MEMORY_FILLP_ATTR] & 1) != 0;
-            fillp_sprites = (m_memory[MEMORY_FILLP_ATTR] & 2) != 0;
-            fillp_graphics_secondary = (m_memory[MEMORY_FILLP_ATTR] & 4) != 0;
+    bool fillp_sprites, fillp_graphics_secondary, transparency;
+    if (c & 0x1000) {
+        transparency = (c & 0x100) != 0;
+        fillp_sprites = (c & 0x200) != 0;
+        fillp_graphics_secondary = (c & 0x400) != 0;
+    } else {
+        fillp = ds->fillp;
+        transparency = ds->fillp_transparent;
+        fillp_sprites = ds->fillp_sprites;
+        fillp_graphics_secondary = ds->fillp_graphics_secondary;
+    }
+    unsigned bit = ((3-y) & 0x3) * 4 + ((3-x) & 0x3);
+    bool on = (fillp & (1 << bit)) != 0;
+    bool use_fillp = (draw_type == DRAWTYPE_GRAPHIC) || (draw_type == DRAWTYPE_SPRITE && fillp_sprites);
+    bool use_secondary_palette = (draw_type == DRAWTYPE_SPRITE  && fillp_sprites) || (draw_type == DRAWTYPE_GRAPHIC && fillp_graphics_secondary);
+    if (use_fillp && transparency && on)
+        return;
+
+    uint8_t col;
+    if (c == -1)
+        c = pencolor_get();
+    if (use_secondary_palette) {
+        uint8_t col_secondary = color_get(PALTYPE_SECONDARY, ds->draw_pal[c & 0xf]);
+        if (on)
+            col = (col_secondary >> 4) & 0xf;
+        else
+            col = col_secondary & 0xf;
+    } else {
+        if (use_fillp) {
+            if (on)
+                c = (c >> 4) & 0xf;
+            else
+                c = c & 0xf;
         }
-        unsigned bit = ((3-y) & 0x3) * 4 + ((3-x) & 0x3);
-        bool on = (fillp & (1 << bit)) != 0;
-        bool use_fillp = (draw_type == DRAWTYPE_GRAPHIC) || (draw_type == DRAWTYPE_SPRITE && fillp_sprites);
-        bool use_secondary_palette = (draw_type == DRAWTYPE_SPRITE  && fillp_sprites) || (draw_type == DRAWTYPE_GRAPHIC && fillp_graphics_secondary);
-        if (!use_fillp || (use_fillp && !transparency) || !on) {
-            uint8_t col;
-            if (c == -1)
-                c = pencolor_get();
-            if (use_secondary_palette) {
-                uint8_t col_draw = color_get(PALTYPE_DRAW, (uint8_t)c);
-                uint8_t col_secondary = color_get(PALTYPE_SECONDARY, col_draw);
-                if (on)
-                    col = (col_secondary >> 4) & 0xf;
-                else
-                    col = col_secondary & 0xf;
-            } else {
-                if (use_fillp) {
-                    if (on)
-                        c = (c >> 4) & 0xf;
-                    else
-                        c = c & 0xf;
-                }
-                col = color_get(PALTYPE_DRAW, c);
+        col = ds->draw_pal[c & 0xf] & 0xf;
+    }
+
+    uint8_t *p = ds->screen + (x >> 1) + y * 64;
+    screen_mark_dirty_rows(y, y);
+    if (ds->rw_mask != 0xff) {
+        uint8_t write_mask = ds->rw_mask & 0xf;
+        uint8_t read_mask = (ds->rw_mask >> 4) & 0xf;
+        uint8_t dst = IS_EVEN(x) ? *p & 0xf : *p >> 4;
+        col = (dst & ~write_mask) | (col & write_mask & read_mask);
+    }
+    *p = IS_EVEN(x) ? (*p & 0xF0) | col : (col << 4) | (*p & 0xF);
+}
+
+// Draw one row of text pixels in colour c: bit i of bits is the pixel at
+// x + i. Equivalent to pixel_set(..., DRAWTYPE_DEFAULT) for each set bit.
+static inline void text_row_blit(int x, int y, uint32_t bits, int c)
+{
+    const draw_state_t *ds = draw_state_get();
+    x -= ds->cx;
+    y -= ds->cy;
+    if (bits == 0 || y < ds->clip_y0 || y >= ds->clip_y1)
+        return;
+    if (x < ds->clip_x0) {
+        if (ds->clip_x0 - x >= 32)
+            return;
+        bits >>= ds->clip_x0 - x;
+        x = ds->clip_x0;
+    }
+    if (x >= ds->clip_x1)
+        return;
+    if (ds->clip_x1 - x < 32)
+        bits &= (1u << (ds->clip_x1 - x)) - 1;
+    if (bits == 0)
+        return;
+
+    if (c == -1)
+        c = pencolor_get();
+    uint8_t col = ds->draw_pal[c & 0xf] & 0xf;
+    uint8_t write_mask = ds->rw_mask & 0xf;
+    uint8_t read_mask = (ds->rw_mask >> 4) & 0xf;
+    uint8_t *row = ds->screen + y * 64;
+    screen_mark_dirty_rows(y, y);
+    for (; bits; bits >>= 1, x++) {
+        if (!(bits & 1))
+            continue;
+        uint8_t *p = row + (x >> 1);
+        uint8_t pixel = col;
+        if (ds->rw_mask != 0xff) {
+            uint8_t dst = IS_EVEN(x) ? *p & 0xf : *p >> 4;
+            pixel = (dst & ~write_mask) | (col & write_mask & read_mask);
+        }
+        *p = IS_EVEN(x) ? (*p & 0xF0) | pixel : (pixel << 4) | (*p & 0xF);
+    }
+}
+
+// Drop the sprite cache if the draw palette has changed since it was filled.
+static inline void sprite_cache_check_palette(void)
+{
+    const uint8_t *draw_pal = &m_memory[MEMORY_PALETTES + PALTYPE_DRAW * 16];
+    if (memcmp(m_sprite_cache_palette, draw_pal, sizeof(m_sprite_cache_palette)) != 0) {
+        memcpy(m_sprite_cache_palette, draw_pal, sizeof(m_sprite_cache_palette));
+        sprite_cache_invalidate_all();
+    }
+}
+
+// Decode sprite n through the draw palette, reusing the previous decode
+// while the sprite is unchanged. Call sprite_cache_check_palette() first.
+static inline const sprite_rows_t *sprite_cache_lookup(int n)
+{
+    const uint8_t *draw_pal = &m_memory[MEMORY_PALETTES + PALTYPE_DRAW * 16];
+    sprite_rows_t *rows = &m_sprite_cache[n];
+    uint32_t bit = 1u << (n & 31);
+    if (m_sprite_cache_valid[n >> 5] & bit)
+        return rows;
+
+    const uint8_t *src = m_memory + gfx_addr_remap(MEMORY_SPRITES) +
+                         (n >> 4) * SPRITE_HEIGHT * 64 + (n & 0xF) * (SPRITE_WIDTH / 2);
+    for (int y = 0; y < SPRITE_HEIGHT; y++, src += 64) {
+        uint32_t pixels = 0;
+        uint8_t opaque = 0;
+        for (int x = 0; x < SPRITE_WIDTH; x++) {
+            uint8_t index = IS_EVEN(x) ? src[x >> 1] & 0xF : src[x >> 1] >> 4;
+            uint8_t color = draw_pal[index];
+            if ((color & 0xf0) == 0) {
+                pixels |= (uint32_t)color << (4 * x);
+                opaque |= 1 << x;
             }
-            gfx_set(x, y, MEMORY_SCREEN, MEMORY_SCREEN_SIZE, col);
         }
+        rows->pixels[y] = pixels;
+        rows->opaque[y] = opaque;
     }
+    m_sprite_cache_valid[n >> 5] |= bit;
+    return rows;
 }
 
-static inline void draw_scaled_sprite(int sx, int sy, int sw, int sh, int dx, int dy, float scale_x, float scale_y, bool flip_x, bool flip_y)
+static inline uint32_t reverse_nibbles(uint32_t v)
 {
-    int dw = roundf(sw * scale_x);
-    int dh = roundf(sh * scale_y);
+    v = ((v >> 4) & 0x0f0f0f0f) | ((v & 0x0f0f0f0f) << 4);
+    v = ((v >> 8) & 0x00ff00ff) | ((v & 0x00ff00ff) << 8);
+    return (v >> 16) | (v << 16);
+}
 
-    if (dw <= 0 || dh <= 0)
-        return;
+static inline uint8_t reverse_bits8(uint8_t b)
+{
+    b = ((b & 0xf0) >> 4) | ((b & 0x0f) << 4);
+    b = ((b & 0xcc) >> 2) | ((b & 0x33) << 2);
+    return ((b & 0xaa) >> 1) | ((b & 0x55) << 1);
+}
 
-    bool fillp_sprites = (m_memory[MEMORY_FILLP_ATTR] & 2) != 0;
-    if (!fillp_sprites && m_memory[MEMORY_RW_MASK] == 0xff) {
-        int cx, cy;
-        camera_get(&cx, &cy);
-        int fdx = dx - cx;
-        int fdy = dy - cy;
-        int x0, y0, x1, y1;
-        clip_get(&x0, &y0, &x1, &y1);
-        if (fdx >= x0 && fdy >= y0 && fdx + dw <= x1 && fdy + dh <= y1 &&
-            fdx >= 0 && fdy >= 0 && fdx + dw <= P8_WIDTH && fdy + dh <= P8_HEIGHT) {
-            // Optimized version for common case: no fillp, no rw mask, fully on screen
-            int base_sprite_offset = gfx_addr_remap(MEMORY_SPRITES);
-            int base_screen_offset = gfx_addr_remap(MEMORY_SCREEN);
-            if (dw > sw && dh > sh) {
-                int sy0 = 0;
-                for (int y = 0; y < dh;)
-                {
-                    int sx0 = 0;
-                    for (int x = 0; x < dw;)
-                    {
-                        int src_x = sx + (flip_x ? (sw - 1 - sx0) : sx0);
-                        int src_y = sy + (flip_y ? (sh - 1 - sy0) : sy0);
-                        int sprite_offset = base_sprite_offset + (src_x >> 1) + src_y * 64;
-                        uint8_t index = IS_EVEN(src_x) ? m_memory[sprite_offset] & 0xF : m_memory[sprite_offset] >> 4;
-                        uint8_t color = color_get(PALTYPE_DRAW, index);
-
-                        int sx1, sy1;
-                        if ((color & 0xf0) == 0) {
-                            int tx = x, ty = y;
-                            do {
-                                x = tx;
-                                do {
-                                    int screen_offset = base_screen_offset + ((fdx + x) >> 1) + (fdy + ty) * 64;
-                                    m_memory[screen_offset] = IS_EVEN(fdx + x) ? (m_memory[screen_offset] & 0xF0) | (color & 0xF) : (color << 4) | (m_memory[screen_offset] & 0xF);
-                                    sx1 = (++x * sw) / dw;
-                                } while (sx0 == sx1 && x < dw);
-                                sy1 = (++ty * sh) / dh;
-                            } while (sy0 == sy1 && y < dh);
-                        } else {
-                            do {
-                                sx1 = (++x * sw) / dw;
-                            } while (sx0 == sx1 && y < dh);
-                        }
-                        sx0 = sx1;
-                    }
-                    int sy1;
-                    do {
-                        sy1 = (++y * sh) / dh;
-                    } while (sy0 == sy1 && y < dh);
-                    sy0 = sy1;
-                }
-            } else {
-                for (int y = 0; y < dh; y++)
-                {
-                    for (int x = 0; x < dw; x++)
-                    {
-                        int src_x = sx + (flip_x ? (sw - 1 - (x * sw) / dw) : (x * sw) / dw);
-                        int src_y = sy + (flip_y ? (sh - 1 - (y * sh) / dh) : (y * sh) / dh);
-                        int sprite_offset = base_sprite_offset + (src_x >> 1) + src_y * 64;
-                        uint8_t index = IS_EVEN(src_x) ? m_memory[sprite_offset] & 0xF : m_memory[sprite_offset] >> 4;
-                        uint8_t color = color_get(PALTYPE_DRAW, index);
-
-                        if ((color & 0xf0) == 0) {
-                            int screen_offset = base_screen_offset + ((fdx + x) >> 1) + (fdy + y) * 64;
-                            m_memory[screen_offset] = IS_EVEN(fdx + x) ? (m_memory[screen_offset] & 0xF0) | (color & 0xF) : (color << 4) | (m_memory[screen_offset] & 0xF);
-                        }
-                    }
-                }
-            } 
-            return;
+// Write pixels x0..x1-1 of a decoded sprite row into a screen line, with
+// pixel 0 at screen x left. Byte-aligned pairs of opaque pixels are stored
+// as whole bytes.
+static inline void blit_sprite_span(uint8_t *line, int left, uint32_t pixels, uint8_t opaque, int x0, int x1)
+{
+    int x = x0;
+    if (!IS_EVEN(left + x)) {
+        if (opaque & (1 << x)) {
+            uint8_t *d = line + ((left + x) >> 1);
+            *d = (*d & 0x0F) | (((pixels >> (4 * x)) & 0xF) << 4);
+        }
+        x++;
+    }
+    for (; x + 1 < x1; x += 2) {
+        uint8_t *d = line + ((left + x) >> 1);
+        uint8_t pair = pixels >> (4 * x);
+        switch ((opaque >> x) & 3) {
+        case 3:
+            *d = pair;
+            break;
+        case 2:
+            *d = (*d & 0x0F) | (pair & 0xF0);
+            break;
+        case 1:
+            *d = (*d & 0xF0) | (pair & 0x0F);
+            break;
         }
     }
+    if (x < x1 && (opaque & (1 << x))) {
+        uint8_t *d = line + ((left + x) >> 1);
+        *d = (*d & 0xF0) | ((pixels >> (4 * x)) & 0xF);
+    }
+}
 
-    for (int y = 0; y < dh; y++)
-    {
-        for (int x = 0; x < dw; x++)
-        {
-            int src_x = sx + (flip_x ? (sw - 1 - (x * sw) / dw) : (x * sw) / dw);
-            int src_y = sy + (flip_y ? (sh - 1 - (y * sh) / dh) : (y * sh) / dh);
-            uint8_t index = gfx_get(src_x, src_y, MEMORY_SPRITES, MEMORY_SPRITES_SIZE);
-            uint8_t color = color_get(PALTYPE_DRAW, (int)index);
+// State for blitting cached sprites, resolved once per spr() or map() call.
+typedef struct {
+    uint8_t *screen;
+    int cx, cy;
+    int clip_x0, clip_y0, clip_x1, clip_y1;
+} sprite_blit_t;
 
-            if ((color & 0xf0) == 0)
-                pixel_set(dx + x, dy + y, index, 0, DRAWTYPE_SPRITE);
+// Returns false if sprites must be drawn pixel by pixel: the fill pattern
+// applies to sprites, the rw mask is active or the sprite sheet is the draw
+// target.
+static inline bool sprite_blit_init(sprite_blit_t *b)
+{
+    const draw_state_t *ds = draw_state_get();
+    int sprite_phys = m_memory[MEMORY_SPRITE_PHYS];
+    int screen_phys = m_memory[MEMORY_SCREEN_PHYS];
+    bool sheet_is_target = abs(sprite_phys - screen_phys) < (MEMORY_SCREEN_SIZE >> 8);
+    b->cx = ds->cx;
+    b->cy = ds->cy;
+    b->clip_x0 = ds->clip_x0;
+    b->clip_y0 = ds->clip_y0;
+    b->clip_x1 = ds->clip_x1;
+    b->clip_y1 = ds->clip_y1;
+    b->screen = ds->screen;
+    if (ds->fillp_sprites || ds->rw_mask != 0xff || sheet_is_target)
+        return false;
+
+    sprite_cache_check_palette();
+    return true;
+}
+
+// Blit columns x0..x1-1 and rows y0..y1-1 of sprite n, already clipped,
+// with its top left corner at screen position (dx, dy).
+static inline void sprite_blit_clipped(const sprite_blit_t *b, int n, int dx, int dy, int x0, int x1, int y0, int y1, bool flip_x, bool flip_y)
+{
+    const sprite_rows_t *rows = sprite_cache_lookup(n);
+    screen_mark_dirty_rows(dy + y0, dy + y1 - 1);
+    for (int y = y0; y < y1; y++) {
+        int fy = flip_y ? (SPRITE_HEIGHT - 1 - y) : y;
+        uint32_t pixels = rows->pixels[fy];
+        uint8_t opaque = rows->opaque[fy];
+        if (opaque == 0)
+            continue;
+        if (flip_x) {
+            pixels = reverse_nibbles(pixels);
+            opaque = reverse_bits8(opaque);
         }
+        blit_sprite_span(b->screen + (dy + y) * 64, dx, pixels, opaque, x0, x1);
     }
 }
 
@@ -609,39 +822,17 @@ static inline void draw_sprite(int n, int left, int top, bool flip_x, bool flip_
     if (sy >= P8_HEIGHT)
         return;
 
-    bool fillp_sprites = (m_memory[MEMORY_FILLP_ATTR] & 2) != 0;
-    if (!fillp_sprites && m_memory[MEMORY_RW_MASK] == 0xff) {
-        int cx, cy;
-        camera_get(&cx, &cy);
-        int dx = left - cx;
-        int dy = top - cy;
-        int x0, y0, x1, y1;
-        clip_get(&x0, &y0, &x1, &y1);
-        if (dx >= x0 && dy >= y0 && (dx + SPRITE_WIDTH) <= x1 && (dy + SPRITE_HEIGHT) <= y1 &&
-            dx >= 0 && dy >= 0 && dx + SPRITE_WIDTH <= P8_WIDTH && dy + SPRITE_HEIGHT <= P8_HEIGHT) {
-            // Optimized version for common case: no fillp, no rw mask, fully on screen
-            int base_sprite_offset = gfx_addr_remap(MEMORY_SPRITES);
-            int base_screen_offset = gfx_addr_remap(MEMORY_SCREEN);
-            for (int x = 0; x < SPRITE_WIDTH; x++)
-            {
-                int fx = flip_x ? (SPRITE_WIDTH - x - 1) : x;
-                int fy = flip_y ? (SPRITE_HEIGHT - 1) : 0;
-                bool screen_even = IS_EVEN(dx + fx);
-                int screen_offset = base_screen_offset + ((dx + fx) >> 1) + (dy + fy) * 64;
-                bool sprite_even = IS_EVEN(sx + x);
-                int sprite_offset = base_sprite_offset + ((sx + x) >> 1) + sy * 64;
-                for (int y = 0; y < SPRITE_HEIGHT; y++)
-                {
-                    uint8_t index = sprite_even ? m_memory[sprite_offset] & 0xF : m_memory[sprite_offset] >> 4;
-                    uint8_t color = color_get(PALTYPE_DRAW, index);
-                    if ((color & 0xf0) == 0)
-                        m_memory[screen_offset] = screen_even ? (m_memory[screen_offset] & 0xF0) | (color & 0xF) : (color << 4) | (m_memory[screen_offset] & 0xF);
-                    screen_offset += flip_y ? -64 : 64;
-                    sprite_offset += 64;
-                }
-            }
-            return;
-        }
+    sprite_blit_t b;
+    if (sprite_blit_init(&b)) {
+        int dx = left - b.cx;
+        int dy = top - b.cy;
+        int x0 = MAX(MAX(b.clip_x0, 0), dx) - dx;
+        int x1 = MIN(b.clip_x1, dx + SPRITE_WIDTH) - dx;
+        int y0 = MAX(MAX(b.clip_y0, 0), dy) - dy;
+        int y1 = MIN(b.clip_y1, dy + SPRITE_HEIGHT) - dy;
+        if (x0 < x1 && y0 < y1)
+            sprite_blit_clipped(&b, n, dx, dy, x0, x1, y0, y1, flip_x, flip_y);
+        return;
     }
 
     for (int y = 0; y < SPRITE_HEIGHT; y++)
@@ -659,6 +850,115 @@ static inline void draw_sprite(int n, int left, int top, bool flip_x, bool flip_
     }
 }
 
+// Step through floor(i * num / den) for consecutive i without dividing.
+typedef struct {
+    int value;
+    int rem;
+    int step;
+    int step_rem;
+    int den;
+} scale_step_t;
+
+static inline void scale_step_init(scale_step_t *s, int i, int num, int den)
+{
+    int64_t product = (int64_t)i * num;
+    s->value = (int)(product / den);
+    s->rem = (int)(product % den);
+    s->step = num / den;
+    s->step_rem = num % den;
+    s->den = den;
+}
+
+static inline void scale_step_next(scale_step_t *s)
+{
+    s->value += s->step;
+    s->rem += s->step_rem;
+    if (s->rem >= s->den) {
+        s->rem -= s->den;
+        s->value++;
+    }
+}
+
+// Draw destination columns x0..x1-1 and rows y0..y1-1 of a scaled sprite,
+// already clipped, with its top left corner at screen position (dx, dy).
+// Each source row is decoded once, however many destination rows repeat it.
+static inline void draw_scaled_sprite_clipped(const sprite_blit_t *b, int sx, int sy, int sw, int sh, int dx, int dy, int dw, int dh, int x0, int x1, int y0, int y1, bool flip_x, bool flip_y)
+{
+    const uint8_t *draw_pal = draw_state_get()->draw_pal;
+    int src_x[P8_WIDTH];
+    uint8_t decoded[P8_WIDTH];
+    int width = x1 - x0;
+
+    scale_step_t step;
+    scale_step_init(&step, x0, sw, dw);
+    for (int i = 0; i < width; i++, scale_step_next(&step))
+        src_x[i] = sx + (flip_x ? sw - 1 - step.value : step.value);
+
+    screen_mark_dirty_rows(dy + y0, dy + y1 - 1);
+    int last_src_y = -1;
+    bool row_opaque = false;
+    scale_step_init(&step, y0, sh, dh);
+    for (int y = y0; y < y1; y++, scale_step_next(&step)) {
+        int src_y = sy + (flip_y ? sh - 1 - step.value : step.value);
+        if (y == y0 || src_y != last_src_y) {
+            last_src_y = src_y;
+            row_opaque = false;
+            for (int i = 0; i < width; i++) {
+                uint8_t color = draw_pal[gfx_get(src_x[i], src_y, MEMORY_SPRITES, MEMORY_SPRITES_SIZE)];
+                decoded[i] = (color & 0xf0) == 0 ? color : 0xff;
+                row_opaque |= decoded[i] != 0xff;
+            }
+        }
+        if (!row_opaque)
+            continue;
+
+        uint8_t *line = b->screen + (dy + y) * 64;
+        for (int i = 0, x = dx + x0; i < width; i++, x++) {
+            uint8_t color = decoded[i];
+            if (color == 0xff)
+                continue;
+            uint8_t *d = line + (x >> 1);
+            *d = IS_EVEN(x) ? (*d & 0xF0) | color : (color << 4) | (*d & 0xF);
+        }
+    }
+}
+
+static inline void draw_scaled_sprite(int sx, int sy, int sw, int sh, int dx, int dy, float scale_x, float scale_y, bool flip_x, bool flip_y)
+{
+    int dw = roundf(sw * scale_x);
+    int dh = roundf(sh * scale_y);
+
+    if (dw <= 0 || dh <= 0)
+        return;
+
+    sprite_blit_t b;
+    if (sw > 0 && sh > 0 && sprite_blit_init(&b)) {
+        int fdx = dx - b.cx;
+        int fdy = dy - b.cy;
+        int x0 = MAX(MAX(b.clip_x0, 0), fdx) - fdx;
+        int x1 = MIN(b.clip_x1, fdx + dw) - fdx;
+        int y0 = MAX(MAX(b.clip_y0, 0), fdy) - fdy;
+        int y1 = MIN(b.clip_y1, fdy + dh) - fdy;
+        if (x0 < x1 && y0 < y1)
+            draw_scaled_sprite_clipped(&b, sx, sy, sw, sh, fdx, fdy, dw, dh, x0, x1, y0, y1, flip_x, flip_y);
+        return;
+    }
+
+    for (int y = 0; y < dh; y++)
+    {
+        for (int x = 0; x < dw; x++)
+        {
+            int src_x = sx + (flip_x ? (sw - 1 - (x * sw) / dw) : (x * sw) / dw);
+            int src_y = sy + (flip_y ? (sh - 1 - (y * sh) / dh) : (y * sh) / dh);
+            uint8_t index = gfx_get(src_x, src_y, MEMORY_SPRITES, MEMORY_SPRITES_SIZE);
+            uint8_t color = color_get(PALTYPE_DRAW, (int)index);
+
+            if ((color & 0xf0) == 0)
+                pixel_set(dx + x, dy + y, index, 0, DRAWTYPE_SPRITE);
+        }
+    }
+}
+
 static inline void draw_sprites(int n, int x, int y, int w, int h, bool flip_x, bool flip_y)
 {
     for (int sy = 0; sy < h; sy++)
@@ -673,20 +973,44 @@ static inline void draw_sprites(int n, int x, int y, int w, int h, bool flip_x,
     }
 }
 
-static inline void draw_char(int n, int left, int top, int col)
+static inline void font_rows_build(void)
 {
-    int sx = n % 16 * 8;
-    int sy = n / 16 * 8;
-
-    for (int y = 0; y < 8; y++)
-    {
-        for (int x = 0; x < 8; x++)
-        {
-            uint8_t index = gfx_addr_get(sx + x, sy + y, (uint8_t *)font_map, 0, sizeof(font_map));
-            if (index == 7)
-                pixel_set(left + x, top + y, col, 0, DRAWTYPE_DEFAULT);
+    for (int n = 0; n < 256; n++) {
+        int sx = n % 16 * 8;
+        int sy = n / 16 * 8;
+        for (int y = 0; y < 8; y++) {
+            uint8_t bits = 0;
+            for (int x = 0; x < 8; x++)
+                if (gfx_addr_get(sx + x, sy + y, (uint8_t *)font_map, 0, sizeof(font_map)) == 7)
+                    bits |= 1 << x;
+            m_font_rows[n][y] = bits;
         }
     }
+    m_font_rows_valid = true;
+}
+
+// Row y of glyph n, bit x set where pixel x is lit. Rows below the glyph
+// run on into the glyph underneath, as they do on the font sheet.
+static inline uint8_t font_row_get(int n, int y, bool use_custom_font)
+{
+    if (use_custom_font && n >= 16) {
+        int offset = MEMORY_FONT + 128 + (n - 16) * 8 + y;
+        if (offset < MEMORY_FONT + MEMORY_FONT_SIZE)
+            return m_memory[offset];
+        return 0;
+    }
+    if (!m_font_rows_valid)
+        font_rows_build();
+    n += (y >> 3) * 16;
+    if (n >= 256)
+        return 0;
+    return m_font_rows[n][y & 7];
+}
+
+static inline void draw_char(int n, int left, int top, int col)
+{
+    for (int y = 0; y < 8; y++)
+        text_row_blit(left, top + y, font_row_get(n, y, false), col);
 }
 
 static inline int get_p8_symbol(const char *str, int str_len, uint8_t *symbol_length)
@@ -749,10 +1073,14 @@ static inline uint8_t gfx_get(int x, int y, int location, int size)
 
 static inline void gfx_set(int x, int y, int location, int size, int col)
 {
-    if (x < 0 || y < 0 || x > P8_WIDTH || y > P8_HEIGHT)
+    if (x < 0 || y < 0 || x >= P8_WIDTH || y >= P8_HEIGHT)
         return;
 
     int offset = gfx_addr_remap(location) + (x >> 1) + y * 64;
+    if (location == MEMORY_SCREEN)
+        screen_mark_dirty_rows(y, y);
+    else
+        memory_mark_written(offset, 1);
     uint8_t rw_mask = m_memory[MEMORY_RW_MASK];
     if (location == MEMORY_SCREEN && rw_mask != 0xff) {
         uint8_t write_mask = rw_mask & 0xf;
@@ -780,6 +1108,7 @@ static inline void camera_set(int x, int y)
     m_memory[MEMORY_CAMERA + 1] = x >> 8;
     m_memory[MEMORY_CAMERA + 2] = y & 0xff;
     m_memory[MEMORY_CAMERA + 3] = y >> 8;
+    draw_state_invalidate();
 }
 
 static inline uint8_t pencolor_get()
@@ -806,6 +1135,7 @@ static inline void color_set(int type, int index, int col)
         m_memory[MEMORY_PALETTE_SECONDARY + (index & 0xf)] = col;
     else
         m_memory[MEMORY_PALETTES + type * 16 + (index & 0xf)] = col;
+    draw_state_invalidate();
 }
 
 static inline void clip_set(int x, int y, int w, int h)
@@ -818,6 +1148,7 @@ static inline void clip_set(int x, int y, int w, int h)
     m_memory[MEMORY_CLIPRECT + 1] = y;
     m_memory[MEMORY_CLIPRECT + 2] = (uint8_t)x1;
     m_memory[MEMORY_CLIPRECT + 3] = (uint8_t)y1;
+    draw_state_invalidate();
 }
 
 static inline void clip_get(int *x0, int *y0, int *x1, int *y1)
@@ -828,6 +1159,30 @@ static inline void clip_get(int *x0, int *y0, int *x1, int *y1)
     *y1 = m_memory[MEMORY_CLIPRECT + 3];
 }
 
+static inline void draw_state_decode(void)
+{
+    draw_state_t *ds = &m_draw_state;
+    camera_get(&ds->cx, &ds->cy);
+    clip_get(&ds->clip_x0, &ds->clip_y0, &ds->clip_x1, &ds->clip_y1);
+    ds->clip_x1 = MIN(ds->clip_x1, P8_WIDTH);
+    ds->clip_y1 = MIN(ds->clip_y1, P8_HEIGHT);
+    ds->fillp = m_memory[MEMORY_FILLP] | (m_memory[MEMORY_FILLP + 1] << 8);
+    ds->fillp_transparent = (m_memory[MEMORY_FILLP_ATTR] & 1) != 0;
+    ds->fillp_sprites = (m_memory[MEMORY_FILLP_ATTR] & 2) != 0;
+    ds->fillp_graphics_secondary = (m_memory[MEMORY_FILLP_ATTR] & 4) != 0;
+    memcpy(ds->draw_pal, &m_memory[MEMORY_PALETTES + PALTYPE_DRAW * 16], sizeof(ds->draw_pal));
+    ds->screen = m_memory + gfx_addr_remap(MEMORY_SCREEN);
+    ds->rw_mask = m_memory[MEMORY_RW_MASK];
+    m_draw_state_valid = true;
+}
+
+static inline const draw_state_t *draw_state_get(void)
+{
+    if (!m_draw_state_valid)
+        draw_state_decode();
+    return &m_draw_state;
+}
+
 static inline void cursor_set(int x, int y, int col)
 {
     m_memory[MEMORY_CURSOR] = x;
@@ -843,22 +1198,23 @@ static inline void cursor_get(int *x, int *y)
     *y = (int)m_memory[MEMORY_CURSOR + 1];
 }
 
-static inline int map_cell_addr(int celx, int cely)
+// Address of cell 0 of map row cely, or -1 if the row is not addressable.
+static inline int map_row_base(int cely)
 {
-    if (celx < 0 || cely < 0)
-        return 0;
+    if (cely < 0)
+        return -1;
 
     uint8_t map_start = m_memory[MEMORY_MAP_START];
     if ((map_start >= 0x10 && map_start < 0x20) ||
         (map_start >= 0x30 && map_start < 0x3f))
-        return 0;
+        return -1;
     if (map_start < 0x10 ||
         (map_start >= 0x40 && map_start < 0x80))
         map_start = 0x20;
     if (map_start < 0x80) {
         int start_offset = m_memory[MEMORY_MAP_START] & 0x0f;
         if (cely >= 32 && cely + start_offset >= 64)
-            return 0;
+            return -1;
     }
     if (cely >= 32 && map_start < 0x80) {
         map_start = 0x10;
@@ -869,9 +1225,17 @@ static inline int map_cell_addr(int celx, int cely)
     if (map_width == 0)
         map_width = 256;
 
-    int map_base = map_start << 8;
-    int offset = celx + cely * map_width;
-    int address = map_base + offset;
+    return (map_start << 8) + cely * map_width;
+}
+
+// Address of cell celx of a row returned by map_row_base(), or 0 if the
+// cell is not addressable.
+static inline int map_row_cell_addr(int row_base, int celx)
+{
+    if (row_base < 0 || celx < 0)
+        return 0;
+
+    int address = row_base + celx;
 
     if (address < 0x1000 || address >= 0x10000 ||
         (address >= 0x3000 && address < 0x8000))
@@ -880,6 +1244,11 @@ static inline int map_cell_addr(int celx, int cely)
     return address;
 }
 
+static inline int map_cell_addr(int celx, int cely)
+{
+    return map_row_cell_addr(map_row_base(cely), celx);
+}
+
 static inline uint8_t map_get(int celx, int cely)
 {
     int address = map_cell_addr(celx, cely);
@@ -894,6 +1263,7 @@ static inline void map_set(int celx, int cely, int snum)
     if (address == 0)
         return;
     m_memory[address] = snum;
+    memory_mark_written(address, 1);
 }
 
 static inline void reset_color()
@@ -935,6 +1305,7 @@ static inline int scroll(int y, int line_height)
         return y;
     memmove(m_memory + (m_memory[MEMORY_SCREEN_PHYS] << 8), m_memory + (m_memory[MEMORY_SCREEN_PHYS] << 8) + 64 * scrolly, 0x2000 - 64 * scrolly);
     memset(m_memory + (m_memory[MEMORY_SCREEN_PHYS] << 8) + 0x2000 - 64 * scrolly, 0, 64 * scrolly);
+    screen_mark_dirty_rows(0, P8_HEIGHT - 1);
     return y - scrolly;
 }
 
@@ -946,6 +1317,7 @@ static inline int scroll_newline(int y)
     int scrolly = MAX(y - threshold, GLYPH_HEIGHT);
     memmove(m_memory + (m_memory[MEMORY_SCREEN_PHYS] << 8), m_memory + (m_memory[MEMORY_SCREEN_PHYS] << 8) + 64 * scrolly, 0x2000 - 64 * scrolly);
     memset(m_memory + (m_memory[MEMORY_SCREEN_PHYS] << 8) + 0x2000 - 64 * scrolly, 0, 64 * scrolly);
+    screen_mark_dirty_rows(0, P8_HEIGHT - 1);
     return y - scrolly;
 }
 
@@ -68,6 +68,7 @@ static inline void overlay_draw_hline(int x0, int x1, int y, int col)
     if (x0 < overlay_clip_x0) x0 = overlay_clip_x0;
     if (x1 >= overlay_clip_x1) x1 = overlay_clip_x1 - 1;
 
+    overlay_mark_dirty_rows(y, y);
     uint8_t *dest = m_overlay_memory + ((x0 >> 1) + y * 64);
 
     // Handle odd start
@@ -98,6 +99,7 @@ static inline void overlay_draw_vline(int x, int y0, int y1, int col)
     if (y0 < overlay_clip_y0) y0 = overlay_clip_y0;
     if (y1 >= overlay_clip_y1) y1 = overlay_clip_y1 - 1;
 
+    overlay_mark_dirty_rows(y0, y1);
     uint8_t *dest = m_overlay_memory + (x >> 1) + y0 * 64;
 
     if ((x & 1) == 0) {
@@ -140,6 +142,7 @@ static inline void overlay_draw_rectfill(int x0, int y0, int x1, int y1, int col
     if (x1 >= overlay_clip_x1) x1 = overlay_clip_x1 - 1;
     if (y1 >= overlay_clip_y1) y1 = overlay_clip_y1 - 1;
 
+    overlay_mark_dirty_rows(y0, y1);
     if (x0 & 1) {
         uint8_t *dest = m_overlay_memory + ((x0 >> 1) + y0 * 64);
         for (int y = y0; y <= y1; y++) {
@@ -193,6 +196,7 @@ static inline void overlay_pixel(int x, int y, int col)
     if (x < overlay_clip_x0 || y < overlay_clip_y0 || x >= overlay_clip_x1 || y >= overlay_clip_y1)
         return;
 
+    overlay_mark_dirty_rows(y, y);
     uint8_t *dest = m_overlay_memory + (x >> 1) + y * 64;
     if (x & 1)
         *dest = (col << 4) | (*dest & 0xF);
@@ -225,6 +229,7 @@ static inline void overlay_scroll_one_line()
 {
     memmove(m_overlay_memory, m_overlay_memory + 64 * GLYPH_HEIGHT, 0x2000 - 64 * GLYPH_HEIGHT);
     memset(m_overlay_memory + 0x2000 - 64 * GLYPH_HEIGHT, 0, 64 * GLYPH_HEIGHT);
+    overlay_mark_dirty_rows(0, P8_HEIGHT - 1);
 }
 
 static inline int overlay_draw_text(const char *str, int x, int y, int col)
@@ -264,6 +269,7 @@ static inline void overlay_draw_simple_text(const char *str, int x, int y, int c
 static inline void overlay_clear(void)
 {
     memset(m_overlay_memory, OVERLAY_TRANSPARENT_COLOR, MEMORY_SCREEN_SIZE);
+    overlay_mark_dirty_rows(0, P8_HEIGHT - 1);
 }
 
 /* Draw a simple arrow-shaped mouse cursor.  Hot-spot is at (mx, my).
@@ -291,6 +297,7 @@ static inline void overlay_draw_mouse_cursor(int mx, int my)
 static inline void overlay_draw_icon(const uint8_t *icon, int x, int y)
 {
     assert((x & 1) == 0);
+    overlay_mark_dirty_rows(y, y + 7);
     uint8_t *dest = m_overlay_memory + (x >> 1) + y * 64;
     for (int r = 0; r < 8; ++r) {
         for (int col = 0; col < 4; col++) {
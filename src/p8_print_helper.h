@@ -83,25 +83,17 @@ static inline bool get_custom_font_y_offset(int char_index)
 
 static inline bool get_font_pixel(int char_index, int x, int y, bool use_custom_font)
 {
-    if (use_custom_font) {
-        if (char_index < 16) {
-            int sx = (char_index % 16) * 8;
-            int sy = (char_index / 16) * 8;
-            uint8_t index = gfx_addr_get(sx + x, sy + y, (uint8_t *)font_map, 0, sizeof(font_map));
-            return (index == 7);
-        }
-        int offset = MEMORY_FONT + 128 + (char_index - 16) * 8 + y;
-        if (offset < MEMORY_FONT + MEMORY_FONT_SIZE) {
-            uint8_t row = m_memory[offset];
-            return (row & (1 << x)) != 0;
-        }
-        return false;
-    } else {
-        int sx = (char_index % 16) * 8;
-        int sy = (char_index / 16) * 8;
-        uint8_t index = gfx_addr_get(sx + x, sy + y, (uint8_t *)font_map, 0, sizeof(font_map));
-        return (index == 7);
-    }
+    return (font_row_get(char_index, y, use_custom_font) >> x) & 1;
+}
+
+// Double each pixel of a glyph row for wide text.
+static inline uint32_t widen_font_row(uint8_t bits)
+{
+    uint32_t wide = 0;
+    for (int x = 0; x < 8; x++)
+        if (bits & (1 << x))
+            wide |= 3u << (2 * x);
+    return wide;
 }
 
 static inline void draw_char_styled(int n, int left, int top, int fg, int bg, print_state_t *state)
@@ -126,6 +118,36 @@ static inline void draw_char_styled(int n, int left, int top, int fg, int bg, pr
     if (render_width > 8) render_width = 8;
     if (render_height > 8) render_height = 8;
 
+    if (!state->outline_enabled) {
+        // Whole rows at a time. Foreground and background pixels never
+        // overlap so the order they are drawn in does not matter.
+        uint8_t width_mask = render_width > 0 ? (1 << render_width) - 1 : 0;
+        for (int y = 0; y < state->char_h; y++) {
+            uint8_t fg_bits = font_row_get(n, y, state->use_custom_font);
+            if (state->invert)
+                fg_bits = ~fg_bits;
+            fg_bits &= width_mask;
+            uint8_t bg_bits = ~fg_bits & width_mask;
+            if (state->outline_skip_interior)
+                fg_bits = 0;
+            uint32_t fg_row = state->wide ? widen_font_row(fg_bits) : fg_bits;
+            uint32_t bg_row = state->wide ? widen_font_row(bg_bits) : bg_bits;
+
+            for (int dy = 0; dy < scale_y; dy++) {
+                // Stripey text draws only the pixels where dx + dy is odd.
+                uint32_t stripes = ~0u;
+                if (state->stripey)
+                    stripes = state->wide ? ((dy & 1) ? 0x55555555 : 0xaaaaaaaa) : ((dy & 1) ? ~0u : 0);
+                int px = left + x_offset;
+                int py = top + y_offset + y * scale_y + dy;
+                text_row_blit(px, py, fg_row & stripes, fg);
+                if (bg != -1)
+                    text_row_blit(px, py, bg_row & stripes, bg);
+            }
+        }
+        return;
+    }
+
     int outline_dx[] = {-1, 0, 1, -1, 1, -1, 0, 1};
     int outline_dy[] = {-1, -1, -1, 0, 0, 1, 1, 1};
 
@@ -400,13 +422,9 @@ static inline void draw_text(const char *str, unsigned str_len, int x, int y, in
 
                                 for (int row = 0; row < 8 && i + 1 < str_len; row++) {
                                     uint8_t byte = str[++i];
-                                    for (int bit = 0; bit < 8; bit++) {
-                                        if (byte & (1 << bit)) {
-                                            pixel_set(draw_x + bit, draw_y + row, fg, 0, DRAWTYPE_DEFAULT);
-                                        } else if (state.solid_bg) {
-                                            pixel_set(draw_x + bit, draw_y + row, bg, 0, DRAWTYPE_DEFAULT);
-                                        }
-                                    }
+                                    text_row_blit(draw_x, draw_y + row, byte, fg);
+                                    if (state.solid_bg)
+                                        text_row_blit(draw_x, draw_y + row, (uint8_t)~byte, bg);
                                 }
                                 x += 8;
                                 last_advance = 8;
@@ -421,13 +439,9 @@ static inline void draw_text(const char *str, unsigned str_len, int x, int y, in
 
                                 for (int row = 0; row < 8; row++) {
                                     uint8_t byte = (hexy(str[i + row*2 + 1]) << 4) | hexy(str[i + row*2 + 2]);
-                                    for (int bit = 0; bit < 8; bit++) {
-                                        if (byte & (1 << bit)) {
-                                            pixel_set(draw_x + bit, draw_y + row, fg, 0, DRAWTYPE_DEFAULT);
-                                        } else if (state.solid_bg) {
-                                            pixel_set(draw_x + bit, draw_y + row, bg, 0, DRAWTYPE_DEFAULT);
-                                        }
-                                    }
+                                    text_row_blit(draw_x, draw_y + row, byte, fg);
+                                    if (state.solid_bg)
+                                        text_row_blit(draw_x, draw_y + row, (uint8_t)~byte, bg);
                                 }
                                 i += 16;
                                 x += 8;
@@ -448,6 +462,7 @@ static inline void draw_text(const char *str, unsigned str_len, int x, int y, in
                                     if ((unsigned)(addr + k) < MEMORY_SIZE)
                                         m_memory[addr + k] = byte;
                                 }
+                                memory_mark_written(addr, count);
 
                                 add_newline = (m_memory[MEMORY_MISCFLAGS] & 0x4) == 0;
                                 wrap_enabled = (m_memory[MEMORY_MISCFLAGS] & 0x80) != 0;
@@ -469,6 +484,7 @@ static inline void draw_text(const char *str, unsigned str_len, int x, int y, in
                                         m_memory[addr + k] = byte;
                                     k++;
                                 }
+                                memory_mark_written(addr, k);
                             }
                             break;
                         case 'o':
@@ -0,0 +1,249 @@
+/**
+ * Copyright (C) 2026 Chris January
+ */
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "p8_audio.h"
+#include "p8_dialog.h"
+#include "p8_emu.h"
+#include "p8_input.h"
+#include "p8_overlay_helper.h"
+#include "p8_profile.h"
+
+#define PROFILE_API_MAX 128
+#define PROFILE_TOP_API 3
+#define SCANCODE_F9 66
+
+#define PANEL_LINES (PROFILE_SECTION_COUNT + PROFILE_TOP_API)
+#define PANEL_HEIGHT (PANEL_LINES * GLYPH_HEIGHT + 2)
+#define BAR_X 18
+#define BAR_WIDTH 80
+#define VALUE_X 100
+
+typedef struct {
+    const char *name;
+    unsigned calls;
+    p8_clock_t clocks;
+} profile_api_t;
+
+bool m_profile_enabled = false;
+
+static const char *section_names[PROFILE_SECTION_COUNT] = { "upd", "drw", "ren", "aud", "gc" };
+static const uint8_t section_colors[PROFILE_SECTION_COUNT] = { 11, 12, 9, 14, 10 };
+
+static p8_clock_t section_clocks[PROFILE_SECTION_COUNT];
+/* Accumulated by the audio thread; only ever added to. */
+static _Atomic p8_clock_t audio_clocks_total = 0;
+static p8_clock_t audio_clocks_seen = 0;
+static p8_clock_t gc_start = 0;
+
+static profile_api_t api[PROFILE_API_MAX];
+static int api_count = 0;
+
+static bool overlay_shown = false;
+static bool overlay_drawn = false;
+static bool toggle_key_down = false;
+static FILE *csv = NULL;
+static bool csv_header_written = false;
+
+static void update_enabled(void)
+{
+    m_profile_enabled = overlay_shown || csv != NULL;
+}
+
+void profile_show_overlay(bool show)
+{
+    overlay_shown = show;
+    update_enabled();
+}
+
+int profile_open_csv(const char *file_name)
+{
+    FILE *fp = fopen(file_name, "w");
+    if (!fp) {
+        fprintf(stderr, "Cannot open profile output %s\n", file_name);
+        return 1;
+    }
+    if (csv)
+        fclose(csv);
+    csv = fp;
+    csv_header_written = false;
+    update_enabled();
+    return 0;
+}
+
+void profile_close(void)
+{
+    if (csv) {
+        fclose(csv);
+        csv = NULL;
+    }
+    update_enabled();
+}
+
+void profile_end(profile_section_t section, p8_clock_t start)
+{
+    // start is 0 if the profiler was switched on since profile_begin().
+    if (!m_profile_enabled || start == 0)
+        return;
+    section_clocks[section] += p8_clock_delta(start, p8_clock());
+}
+
+void profile_audio_end(p8_clock_t start)
+{
+    if (!m_profile_enabled || start == 0)
+        return;
+    atomic_fetch_add_explicit(&audio_clocks_total, p8_clock_delta(start, p8_clock()), memory_order_relaxed);
+}
+
+void profile_gc_step_begin(void)
+{
+    if (m_profile_enabled)
+        gc_start = p8_clock();
+}
+
+void profile_gc_step_end(void)
+{
+    if (m_profile_enabled && gc_start != 0) {
+        section_clocks[PROFILE_GC] += p8_clock_delta(gc_start, p8_clock());
+        gc_start = 0;
+    }
+}
+
+int profile_api_register(const char *name)
+{
+    for (int i = 0; i < api_count; i++)
+        if (strcmp(api[i].name, name) == 0)
+            return i;
+    if (api_count == PROFILE_API_MAX)
+        return -1;
+    api[api_count].name = name;
+    return api_count++;
+}
+
+void profile_api_end(int slot, p8_clock_t start)
+{
+    if (slot < 0)
+        return;
+    api[slot].calls++;
+    api[slot].clocks += p8_clock_delta(start, p8_clock());
+}
+
+static void write_csv_row(void)
+{
+    if (!csv_header_written) {
+        fputs("frame", csv);
+        for (int i = 0; i < PROFILE_SECTION_COUNT; i++)
+            fprintf(csv, ",%s_us", section_names[i]);
+#ifdef ENABLE_AUDIO
+        fputs(",aud_overflows,aud_underruns", csv);
+#endif
+        for (int i = 0; i < api_count; i++)
+            fprintf(csv, ",%s_calls,%s_us", api[i].name, api[i].name);
+        fputc('\n', csv);
+        csv_header_written = true;
+    }
+
+    fprintf(csv, "%u", m_frames);
+    for (int i = 0; i < PROFILE_SECTION_COUNT; i++)
+        fprintf(csv, ",%u", p8_clock_us(section_clocks[i]));
+#ifdef ENABLE_AUDIO
+    fprintf(csv, ",%u,%u", audio_overflows(), audio_underruns());
+#endif
+    for (int i = 0; i < api_count; i++)
+        fprintf(csv, ",%u,%u", api[i].calls, p8_clock_us(api[i].clocks));
+    fputc('\n', csv);
+}
+
+static void draw_value(unsigned us, int y)
+{
+    char text[16];
+    snprintf(text, sizeof(text), "%u.%02u", us / 1000, (us % 1000) / 10);
+    overlay_draw_simple_text(text, VALUE_X, y, 7);
+}
+
+static void draw_overlay(void)
+{
+    unsigned budget_us = 1000000 / m_fps;
+
+    overlay_draw_rectfill(0, 0, P8_WIDTH - 1, PANEL_HEIGHT - 1, 1);
+
+    int y = 1;
+    for (int i = 0; i < PROFILE_SECTION_COUNT; i++, y += GLYPH_HEIGHT) {
+        unsigned us = p8_clock_us(section_clocks[i]);
+        unsigned width = (unsigned)((uint64_t)us * BAR_WIDTH / budget_us);
+        overlay_draw_simple_text(section_names[i], 1, y, 7);
+        if (width > 0) {
+            int col = width > BAR_WIDTH ? 8 : section_colors[i];
+            if (width > BAR_WIDTH)
+                width = BAR_WIDTH;
+            overlay_draw_rectfill(BAR_X, y, BAR_X + width - 1, y + GLYPH_HEIGHT - 2, col);
+        }
+        draw_value(us, y);
+    }
+
+    // The most expensive API functions this frame.
+    bool shown[PROFILE_API_MAX] = { false };
+    for (int n = 0; n < PROFILE_TOP_API; n++, y += GLYPH_HEIGHT) {
+        int top = -1;
+        for (int i = 0; i < api_count; i++)
+            if (!shown[i] && api[i].calls > 0 && (top < 0 || api[i].clocks > api[top].clocks))
+                top = i;
+        if (top < 0)
+            break;
+        shown[top] = true;
+
+        char text[16];
+        snprintf(text, sizeof(text), "%.8s", api[top].name);
+        overlay_draw_simple_text(text, 1, y, 6);
+        snprintf(text, sizeof(text), "x%u", api[top].calls);
+        overlay_draw_simple_text(text, 38, y, 6);
+        draw_value(p8_clock_us(api[top].clocks), y);
+    }
+}
+
+static void update_overlay(void)
+{
+    if (m_dialog_showing)
+        return;
+
+    int x, y, w, h;
+    overlay_clip_get(&x, &y, &w, &h);
+    overlay_clip_reset();
+    if (overlay_shown) {
+        draw_overlay();
+        overlay_drawn = true;
+    } else if (overlay_drawn) {
+        overlay_draw_rectfill(0, 0, P8_WIDTH - 1, PANEL_HEIGHT - 1, OVERLAY_TRANSPARENT_COLOR);
+        overlay_drawn = false;
+    }
+    overlay_clip_set(x, y, w, h);
+}
+
+void profile_end_frame(void)
+{
+    bool key_down = p8_is_key_down(SCANCODE_F9);
+    if (key_down && !toggle_key_down)
+        profile_show_overlay(!overlay_shown);
+    toggle_key_down = key_down;
+
+    if (!m_profile_enabled && !overlay_drawn)
+        return;
+
+    p8_clock_t audio_total = atomic_load_explicit(&audio_clocks_total, memory_order_relaxed);
+    section_clocks[PROFILE_AUDIO] = audio_total - audio_clocks_seen;
+    audio_clocks_seen = audio_total;
+
+    if (csv)
+        write_csv_row();
+    update_overlay();
+
+    memset(section_clocks, 0, sizeof(section_clocks));
+    for (int i = 0; i < api_count; i++) {
+        api[i].calls = 0;
+        api[i].clocks = 0;
+    }
+}
@@ -0,0 +1,79 @@
+/**
+ * Copyright (C) 2026 Chris January
+ *
+ * Frame profiler: time spent each frame in _update, _draw, presenting the
+ * frame, the audio callback and the garbage collector, plus call counts
+ * and time for each Lua API function. Shown as a bar chart on the overlay
+ * and optionally written to a CSV file, one row per frame.
+ */
+
+#ifndef P8_PROFILE_H
+#define P8_PROFILE_H
+
+#include <stdbool.h>
+#include "p8_emu.h"
+
+typedef enum {
+    PROFILE_UPDATE,
+    PROFILE_DRAW,
+    PROFILE_RENDER,
+    PROFILE_AUDIO,
+    PROFILE_GC,
+    PROFILE_SECTION_COUNT
+} profile_section_t;
+
+/* Whether timings are being collected (overlay shown or CSV open). */
+extern bool m_profile_enabled;
+
+/**
+ * Show or hide the overlay. F9 toggles it while a cart is running.
+ */
+void profile_show_overlay(bool show);
+
+/**
+ * Write one row of timings per frame to the given file.
+ *
+ * @return 0 on success, non-zero on error
+ */
+int profile_open_csv(const char *file_name);
+
+void profile_close(void);
+
+static inline p8_clock_t profile_begin(void)
+{
+    return m_profile_enabled ? p8_clock() : 0;
+}
+
+/**
+ * Add the time since start, as returned by profile_begin(), to a section.
+ * Not for PROFILE_AUDIO, which has its own entry point because it runs on
+ * the audio thread.
+ */
+void profile_end(profile_section_t section, p8_clock_t start);
+
+void profile_audio_end(p8_clock_t start);
+
+/* Called by the Lua collector around each incremental step. */
+void profile_gc_step_begin(void);
+void profile_gc_step_end(void);
+
+/**
+ * Get the statistics slot for a Lua API function, allocating one the first
+ * time a name is seen.
+ *
+ * @return the slot, or -1 if there are no free slots
+ */
+int profile_api_register(const char *name);
+
+/**
+ * Count one call of an API function that started at start.
+ */
+void profile_api_end(int slot, p8_clock_t start);
+
+/**
+ * Close the current frame: handle the toggle key, write the CSV row,
+ * redraw the overlay and reset the counters.
+ */
+void profile_end_frame(void);
+
+#endif
@@ -0,0 +1,164 @@
+/**
+ * Copyright (C) 2026 Chris January
+ */
+
+#include <ctype.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "p8_emu.h"
+#include "p8_replay.h"
+
+/* Start of the virtual clock: 2026-01-01 00:00:00 UTC */
+#define REPLAY_EPOCH ((time_t)1767225600)
+
+typedef struct {
+    unsigned frame;
+    uint16_t buttons[PLAYER_COUNT];
+} replay_input_t;
+
+static replay_input_t *input_script = NULL;
+static unsigned input_count = 0;
+static unsigned input_index = 0;
+
+static bool active = false;
+static bool has_seed = false;
+static uint32_t rng_seed = 0;
+static unsigned frame_limit = 0;
+static unsigned hash_interval = 0;
+static unsigned frame = 0;
+
+int replay_load_input(const char *file_name)
+{
+    FILE *fp = fopen(file_name, "r");
+    if (!fp) {
+        fprintf(stderr, "Cannot open input script %s\n", file_name);
+        return 1;
+    }
+
+    char line[256];
+    unsigned capacity = 0;
+    unsigned lineno = 0;
+    int ret = 0;
+    while (fgets(line, sizeof(line), fp)) {
+        lineno++;
+        char *p = line;
+        while (isspace((unsigned char)*p))
+            p++;
+        if (*p == '\0' || *p == '#')
+            continue;
+
+        replay_input_t entry = {0};
+        char *end;
+        entry.frame = strtoul(p, &end, 0);
+        if (end == p) {
+            fprintf(stderr, "%s:%u: expected frame number\n", file_name, lineno);
+            ret = 1;
+            break;
+        }
+        for (int i = 0; i < PLAYER_COUNT; i++) {
+            p = end;
+            entry.buttons[i] = strtoul(p, &end, 0);
+            if (end == p)
+                break;
+        }
+        if (input_count > 0 && entry.frame < input_script[input_count - 1].frame) {
+            fprintf(stderr, "%s:%u: frames out of order\n", file_name, lineno);
+            ret = 1;
+            break;
+        }
+
+        if (input_count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            replay_input_t *grown = realloc(input_script, capacity * sizeof(replay_input_t));
+            if (!grown) {
+                fputs("Out of memory\n", stderr);
+                ret = 1;
+                break;
+            }
+            input_script = grown;
+        }
+        input_script[input_count++] = entry;
+    }
+    fclose(fp);
+
+    active = true;
+    return ret;
+}
+
+void replay_set_frame_limit(unsigned frames)
+{
+    frame_limit = frames;
+    active = true;
+}
+
+void replay_set_hash_interval(unsigned frames)
+{
+    hash_interval = frames;
+    active = true;
+}
+
+void replay_set_seed(uint32_t seed)
+{
+    rng_seed = seed;
+    has_seed = true;
+    active = true;
+}
+
+bool replay_is_active(void)
+{
+    return active;
+}
+
+bool replay_get_seed(uint32_t *seed)
+{
+    if (!has_seed)
+        return false;
+    *seed = rng_seed;
+    return true;
+}
+
+time_t replay_time(void)
+{
+    return REPLAY_EPOCH + frame / m_fps;
+}
+
+bool replay_apply_input(uint16_t *buttons, int player_count)
+{
+    if (!input_script)
+        return false;
+
+    while (input_index + 1 < input_count && input_script[input_index + 1].frame <= frame)
+        input_index++;
+
+    const replay_input_t *entry = &input_script[input_index];
+    for (int i = 0; i < player_count && i < PLAYER_COUNT; i++)
+        buttons[i] = entry->frame <= frame ? entry->buttons[i] : 0;
+    return true;
+}
+
+// 64-bit FNV-1a
+static uint64_t hash_bytes(const uint8_t *data, size_t length)
+{
+    uint64_t hash = UINT64_C(0xcbf29ce484222325);
+    for (size_t i = 0; i < length; i++) {
+        hash ^= data[i];
+        hash *= UINT64_C(0x100000001b3);
+    }
+    return hash;
+}
+
+bool replay_end_frame(void)
+{
+    frame++;
+
+    if (hash_interval != 0 && frame % hash_interval == 0) {
+        printf("frame %u screen %016" PRIx64 " ram %016" PRIx64 "\n",
+               frame,
+               hash_bytes(m_memory + MEMORY_SCREEN, MEMORY_SCREEN_SIZE),
+               hash_bytes(m_memory, MEMORY_SCREEN));
+    }
+
+    return frame_limit != 0 && frame >= frame_limit;
+}
@@ -0,0 +1,73 @@
+/**
+ * Copyright (C) 2026 Chris January
+ *
+ * Deterministic replay: scripted input, fixed RNG seed, virtual clock and
+ * periodic state hashing for automated regression runs.
+ */
+
+#ifndef P8_REPLAY_H
+#define P8_REPLAY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * Load a button script. Each non-blank line not starting with '#' has
+ * the form "<frame> <player 0 mask> [<player 1 mask>]"; the masks take
+ * effect from that frame until the next line. Lines must be in frame order.
+ *
+ * @return 0 on success, non-zero on error
+ */
+int replay_load_input(const char *file_name);
+
+/**
+ * Quit after the given number of frames (0 = run until the cart exits).
+ */
+void replay_set_frame_limit(unsigned frames);
+
+/**
+ * Print hashes of the screen and RAM every given number of frames
+ * (0 = never).
+ */
+void replay_set_hash_interval(unsigned frames);
+
+/**
+ * Use a fixed RNG seed for every cart reset instead of the wall clock.
+ */
+void replay_set_seed(uint32_t seed);
+
+/**
+ * Whether any replay option is in effect. When active, wall-clock
+ * time is replaced by a virtual clock derived from the frame count.
+ */
+bool replay_is_active(void);
+
+/**
+ * Get the RNG seed for a cart reset.
+ *
+ * @return true if a fixed seed was set, false to use the default
+ */
+bool replay_get_seed(uint32_t *seed);
+
+/**
+ * Current time of the virtual frame clock.
+ */
+time_t replay_time(void);
+
+/**
+ * Overwrite the button state for the upcoming frame from the input
+ * script.
+ *
+ * @return true if the buttons were overwritten
+ */
+bool replay_apply_input(uint16_t *buttons, int player_count);
+
+/**
+ * Advance the frame counter and print hashes if due.
+ *
+ * @return true once the frame limit has been reached
+ */
+bool replay_end_frame(void);
+
+#endif
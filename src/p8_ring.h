@@ -0,0 +1,112 @@
+/**
+ * Copyright (C) 2026 Chris January
+ *
+ * Wait-free ring buffer for one producer thread and one consumer thread.
+ * Neither side ever blocks: a push to a full ring is dropped and counted,
+ * a pop from an empty ring fails.
+ */
+
+#ifndef P8_RING_H
+#define P8_RING_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+typedef struct
+{
+    uint8_t *data;
+    unsigned element_size;
+    unsigned capacity;         // elements; must be a power of two
+    atomic_uint head;          // next element to write, owned by the producer
+    atomic_uint tail;          // next element to read, owned by the consumer
+    atomic_uint overflows;     // elements dropped because the ring was full
+} ring_t;
+
+#define RING_INIT(buffer, count) \
+    { (uint8_t *)(buffer), sizeof((buffer)[0]), (count), 0, 0, 0 }
+
+/* Number of elements waiting. Exact on either thread for its own side. */
+static inline unsigned ring_count(ring_t *ring)
+{
+    return atomic_load_explicit(&ring->head, memory_order_acquire) -
+           atomic_load_explicit(&ring->tail, memory_order_acquire);
+}
+
+static inline unsigned ring_space(ring_t *ring)
+{
+    return ring->capacity - ring_count(ring);
+}
+
+/* Producer only. */
+static inline bool ring_push(ring_t *ring, const void *element)
+{
+    unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head - tail == ring->capacity) {
+        atomic_fetch_add_explicit(&ring->overflows, 1, memory_order_relaxed);
+        return false;
+    }
+    memcpy(ring->data + (head & (ring->capacity - 1)) * ring->element_size, element, ring->element_size);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return true;
+}
+
+/* Producer only. Push as many of count elements as fit and return how many. */
+static inline unsigned ring_write(ring_t *ring, const void *elements, unsigned count)
+{
+    unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    unsigned space = ring->capacity - (head - tail);
+    if (count > space) {
+        atomic_fetch_add_explicit(&ring->overflows, count - space, memory_order_relaxed);
+        count = space;
+    }
+    const uint8_t *src = (const uint8_t *)elements;
+    unsigned start = head & (ring->capacity - 1);
+    unsigned first = ring->capacity - start;
+    if (first > count)
+        first = count;
+    memcpy(ring->data + start * ring->element_size, src, first * ring->element_size);
+    memcpy(ring->data, src + first * ring->element_size, (count - first) * ring->element_size);
+    atomic_store_explicit(&ring->head, head + count, memory_order_release);
+    return count;
+}
+
+/* Consumer only. */
+static inline bool ring_pop(ring_t *ring, void *element)
+{
+    unsigned tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    unsigned head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (head == tail)
+        return false;
+    memcpy(element, ring->data + (tail & (ring->capacity - 1)) * ring->element_size, ring->element_size);
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+/* Consumer only. Pop up to count elements and return how many. */
+static inline unsigned ring_read(ring_t *ring, void *elements, unsigned count)
+{
+    unsigned tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    unsigned head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (count > head - tail)
+        count = head - tail;
+    uint8_t *dest = (uint8_t *)elements;
+    unsigned start = tail & (ring->capacity - 1);
+    unsigned first = ring->capacity - start;
+    if (first > count)
+        first = count;
+    memcpy(dest, ring->data + start * ring->element_size, first * ring->element_size);
+    memcpy(dest + first * ring->element_size, ring->data, (count - first) * ring->element_size);
+    atomic_store_explicit(&ring->tail, tail + count, memory_order_release);
+    return count;
+}
+
+static inline unsigned ring_overflows(ring_t *ring)
+{
+    return atomic_load_explicit(&ring->overflows, memory_order_relaxed);
+}
+
+#endif /* P8_RING_H */
@@ -0,0 +1,47 @@
+#!/bin/bash
+# Audio regression check: renders celeste_music.p8 offline and compares the
+# SHA-256 of the WAV with the golden hash in celeste_music.sha256.
+#
+# Usage: tests/regression/audio/check.sh [--update] [path/to/femto8]
+#   --update   write the hash of the new render as the golden hash
+# The emulator defaults to ./femto8 in the current directory.
+
+set -e
+
+UPDATE=0
+if [ "$1" = "--update" ]; then
+    UPDATE=1
+    shift
+fi
+FEMTO8="${1:-./femto8}"
+DIR="$(cd "$(dirname "$0")" && pwd)"
+CART="$DIR/celeste_music.p8"
+GOLDEN="$DIR/celeste_music.sha256"
+FRAMES=600
+
+sha256() {
+    if command -v sha256sum > /dev/null; then
+        sha256sum "$1" | cut -d ' ' -f 1
+    else
+        shasum -a 256 "$1" | cut -d ' ' -f 1
+    fi
+}
+
+WAV="$(mktemp "${TMPDIR:-/tmp}/celeste_music.XXXXXX")"
+trap 'rm -f "$WAV"' EXIT
+
+"$FEMTO8" --headless --frames $FRAMES --seed 1 --wav "$WAV" "$CART"
+HASH="$(sha256 "$WAV")"
+
+if [ $UPDATE -eq 1 ]; then
+    echo "$HASH" > "$GOLDEN"
+    echo "audio: golden hash updated to $HASH"
+    exit 0
+fi
+
+EXPECTED="$(cat "$GOLDEN")"
+if [ "$HASH" != "$EXPECTED" ]; then
+    echo "audio: FAIL (expected $EXPECTED, got $HASH)"
+    exit 1
+fi
+echo "audio: PASS"